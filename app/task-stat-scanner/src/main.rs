@@ -1,16 +1,24 @@
-use bpf_comm::task_storage::TaskStorage;
+use bpf_comm::hash_map::HashMap;
 
 use rustyline::error::ReadlineError;
 use rustyline::Editor;
 
 
+/*
+ * The value of the est_ctx map, struct bpf_dag_runtime_est in dag_bpf.h.
+ * The estimates are in ns.
+ */
 #[repr(C)]
+#[derive(Default)]
 struct EstCtx {
-	estimated_exec_time: i64,
+	last: i64,
+	ewma: i64,
+	estimated_exec_time: i64, // the high-percentile estimate
+	nr_samples: u64,
 }
 
 fn main() {
-	let task_storage = TaskStorage::new("est_ctx").unwrap();
+	let est_ctx = HashMap::new("est_ctx").unwrap();
 
 	let mut rl = Editor::<()>::new();
 	if rl.load_history("history.txt").is_err() {
@@ -24,10 +32,11 @@ fn main() {
 				rl.add_history_entry(line.as_str());
 
 				if let Ok(tid) = i32::from_str_radix(&line, 10) {
-					let mut ctx = EstCtx { estimated_exec_time: -1 };
-					let result = task_storage.lookup_elem(tid, &mut ctx);
+					let mut ctx = EstCtx::default();
+					let result = est_ctx.lookup_elem(&tid, &mut ctx);
 					match result {
-						Ok(_) => println!("estimated_exec_time: {}", ctx.estimated_exec_time),
+						Ok(_) => println!("estimated_exec_time: {} (ewma: {}, last: {}, samples: {})",
+							ctx.estimated_exec_time, ctx.ewma, ctx.last, ctx.nr_samples),
 						Err(_) => println!("Failed to read estimated_exec_time.."),
 					}
 				}
@@ -13,29 +13,130 @@
 #endif
 
 extern struct bpf_dag_task *bpf_dag_task_alloc(u32 src_node_tid, u32 src_node_weight, s64 relative_deadline, s64 period) __weak __ksym;
+extern struct bpf_dag_task *bpf_dag_task_alloc_bulk(struct bpf_dag_bulk_graph *graph, u32 graph__sz) __weak __ksym;
 extern void bpf_dag_task_dump(struct bpf_dag_task *dag_task) __weak __ksym;
 extern void bpf_dag_task_free(struct bpf_dag_task *dag_task) __weak __ksym;
 extern s32 bpf_dag_task_add_node(struct bpf_dag_task *dag_task, u32 tid, u32 weight) __weak __ksym;
 extern s32 bpf_dag_task_add_edge(struct bpf_dag_task *dag_task, u32 from, u32 to) __weak __ksym;
+extern s32 bpf_dag_task_reserve(struct bpf_dag_task *dag_task, u32 nr_nodes, u32 nr_edges) __weak __ksym;
 extern void bpf_dag_task_culc_HELT_prio(struct bpf_dag_task *dag_task) __weak __ksym;
 extern void bpf_dag_task_culc_HLBS_prio(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s32 bpf_dag_task_culc_slack(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s32 bpf_dag_task_get_slack(struct bpf_dag_task *dag_task, u32 node_id, struct bpf_dag_node_slack *slack) __weak __ksym;
+extern s32 bpf_dag_task_commit(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s32 bpf_dag_task_get_node_id(struct bpf_dag_task *dag_task, u32 tid) __weak __ksym;
 extern s64 bpf_dag_task_get_weight(struct bpf_dag_task *dag_task, u32 node_id) __weak __ksym;
 extern s32 bpf_dag_task_set_weight(struct bpf_dag_task *dag_task, u32 node_id, s64 weight) __weak __ksym;
+extern s32 bpf_dag_task_set_weights(struct bpf_dag_task *dag_task, struct bpf_dag_weight_update *updates, u32 updates__sz) __weak __ksym;
 extern s64 bpf_dag_task_get_prio(struct bpf_dag_task *dag_task, u32 node_id) __weak __ksym;
+extern s64 bpf_dag_task_job_release(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s32 bpf_dag_task_job_complete(struct bpf_dag_task *dag_task, u64 job) __weak __ksym;
+extern s64 bpf_dag_task_job_get_prio(struct bpf_dag_task *dag_task, u64 job, u32 node_id) __weak __ksym;
+extern s64 bpf_dag_task_job_get_deadline(struct bpf_dag_task *dag_task, u64 job) __weak __ksym;
+extern s32 bpf_dag_task_node_complete(struct bpf_dag_task *dag_task, u64 job, u32 node_id, u32 *ready, u32 ready__sz) __weak __ksym;
+extern s32 bpf_dag_task_job_get_pending(struct bpf_dag_task *dag_task, u64 job, u32 node_id) __weak __ksym;
+extern s32 bpf_dag_task_node_start(struct bpf_dag_task *dag_task, u32 node_id) __weak __ksym;
+extern s64 bpf_dag_task_node_stop(struct bpf_dag_task *dag_task, u32 node_id, u32 flags) __weak __ksym;
+extern s32 bpf_dag_task_get_runtime_est(struct bpf_dag_task *dag_task, u32 node_id, struct bpf_dag_runtime_est *est) __weak __ksym;
+extern s64 bpf_dag_task_get_volume(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s64 bpf_dag_task_get_critical_path(struct bpf_dag_task *dag_task) __weak __ksym;
+extern s32 bpf_dag_task_federated_assign(void) __weak __ksym;
+extern s32 bpf_dag_task_get_cpumask(struct bpf_dag_task *dag_task, struct bpf_cpumask *dst) __weak __ksym;
+extern s32 bpf_dag_rq_push(s32 cpu, struct bpf_dag_task *dag_task, u64 job, u32 node_id) __weak __ksym;
+extern s32 bpf_dag_rq_remove(struct bpf_dag_task *dag_task, u32 node_id) __weak __ksym;
+extern s32 bpf_dag_rq_pop_min(s32 cpu, struct bpf_dag_rq_item *item) __weak __ksym;
+extern s32 bpf_dag_rq_peek_min(s32 cpu, struct bpf_dag_rq_item *item) __weak __ksym;
+extern s32 bpf_dag_rq_steal(s32 cpu, struct bpf_dag_rq_item *item) __weak __ksym;
+extern s64 bpf_dag_prio_encode(s64 time_ns, u32 dag_id, u32 rank) __weak __ksym;
+extern s64 bpf_dag_prio_decode_time(s64 prio) __weak __ksym;
+extern u32 bpf_dag_prio_decode_dag(s64 prio) __weak __ksym;
+extern u32 bpf_dag_prio_decode_rank(s64 prio) __weak __ksym;
 extern s32 bpf_sys_info_update_cpu_prio(s32 cpu, s32 pid, s64 prio) __weak __ksym;
 extern s32 bpf_sys_info_get_max_prio_and_cpu(s32 *cpu, s32 *pid, s64 *prio) __weak __ksym;
+extern s32 bpf_sys_info_get_max_prio_and_cpu_in(const struct cpumask *mask, s32 *cpu, s32 *pid, s64 *prio) __weak __ksym;
+extern s32 bpf_sys_info_get_max_prio_and_cpu_llc(s32 this_cpu, s32 *cpu, s32 *pid, s64 *prio) __weak __ksym;
+extern s32 bpf_sys_info_get_max_prio_and_cpu_node(s32 this_cpu, s32 *cpu, s32 *pid, s64 *prio) __weak __ksym;
+extern s32 bpf_sys_info_get_victims(struct bpf_sys_info_victim *victims, u32 victims__sz, u32 flags) __weak __ksym;
+extern s32 bpf_sys_info_release_cpu(s32 cpu) __weak __ksym;
+
+/*
+ * Flags of bpf_sys_info_get_victims()
+ */
+#ifndef BPF_SYS_INFO_RESERVE
+#define BPF_SYS_INFO_RESERVE	(1U << 0)
+#endif
+
+/*
+ * Flags of bpf_dag_task_node_stop()
+ */
+#ifndef BPF_DAG_EST_SET_WEIGHT_EWMA
+#define BPF_DAG_EST_SET_WEIGHT_EWMA	(1U << 0)
+#define BPF_DAG_EST_SET_WEIGHT_PCTL	(1U << 1)
+#endif
+
+/*
+ * The cpu argument of the bpf_dag_rq kfuncs selecting the global ready queue
+ */
+#ifndef BPF_DAG_RQ_GLOBAL
+#define BPF_DAG_RQ_GLOBAL	(-1)
+#endif
+
+/*
+ * cpumask kfuncs provided by the kernel
+ */
+struct cpumask;
+struct bpf_cpumask;
+extern struct bpf_cpumask *bpf_cpumask_create(void) __weak __ksym;
+extern void bpf_cpumask_release(struct bpf_cpumask *cpumask) __weak __ksym;
+extern void bpf_cpumask_set_cpu(u32 cpu, struct bpf_cpumask *cpumask) __weak __ksym;
+extern u32 bpf_cpumask_weight(const struct cpumask *cpumask) __weak __ksym;
+
+/*
+ * dynptr kfuncs provided by the kernel
+ */
+extern __u32 bpf_dynptr_size(const struct bpf_dynptr *p) __weak __ksym;
 
 enum bpf_dag_msg_type {
 	BPF_DAG_MSG_NEW_TASK,	// 新しいDAGタスクが作成されたことを伝えるメッセージ（DAGタスクの識別番号はsrc nodeのtid）
 	BPF_DAG_MSG_ADD_NODE,
 	BPF_DAG_MSG_ADD_EDGE,
-	BPF_DAG_MSG_COMMIT,	// TODO: このメッセージでやりたいこと
-				//	1. DAGタスクがwell-formedか？
+	BPF_DAG_MSG_COMMIT,	// DAGタスクの形状を確定させるメッセージ
+				//	1. DAGタスクがwell-formedかを一度だけ検査する
 				//		- 連結か？
 				//		- トポロジカルソートされているか？
 				//		- 変な遷移辺がないか？
-				//		- etc..
 				//	2. 以降のDAGタスクの形状の変更を禁止する
+				//	3. 読み出しに適したレイアウトに詰め直す
+	BPF_DAG_MSG_BULK_GRAPH,	// DAGタスク全体（ノード、重み、辺、デッドライン、周期）を1つで運ぶ可変長のメッセージ
+				//	ペイロードはstruct bpf_dag_bulk_graphとそれに続くノードと辺の配列で、
+				//	bpf_dag_task_alloc_bulkで一度に作成・コミットされる
+};
+
+/*
+ * The maximum size of the payload of BPF_DAG_MSG_BULK_GRAPH. It fits a DAG
+ * task of DAG_TASK_MAX_NODES nodes and DAG_TASK_MAX_EDGES edges.
+ */
+#define BPF_DAG_MSG_BULK_GRAPH_MAX_SIZE	(1 << 20)
+
+/*
+ * Every urb message begins with this header, followed by the payload of type.
+ * seq is chosen by userspace and echoed back in the ack of the message.
+ */
+struct bpf_dag_msg_header {
+	u32 type; // enum bpf_dag_msg_type
+	u32 __pad;
+	u64 seq;
+};
+
+/*
+ * A record of the dag_acks ring buffer, posted for every urb message in the order
+ * they are drained.
+ */
+struct bpf_dag_msg_ack {
+	u64 seq;
+	u32 type; // enum bpf_dag_msg_type
+	u32 __pad;
+	s64 ret; // 0以上なら成功（NEW_TASK/BULK_GRAPH: DAGタスクのid, ADD_NODE: ノードのid, ADD_EDGE: 辺のid, COMMIT: 0）、負ならエラー
 };
 
 struct bpf_dag_msg_new_task_payload {
@@ -59,4 +160,24 @@ struct bpf_dag_msg_commit_payload {
 	u32 dag_task_id;
 };
 
+/*
+ * A record of the dag_events ring buffer. The meaning of id, arg0 and arg1
+ * depends on type.
+ */
+enum bpf_dag_event_type {
+	BPF_DAG_EVENT_GRAPH_CHANGE,	// id: DAGタスクのid, arg0: メッセージの種類, arg1: 追加したノードか辺のid（それ以外は0）
+	BPF_DAG_EVENT_PRIO_RECOMPUTE,	// id: DAGタスクのid, arg0: 優先度が変わったノードの数
+	BPF_DAG_EVENT_JOB_RELEASE,	// id: DAGタスクのid, arg0: ジョブのハンドル
+	BPF_DAG_EVENT_DEADLINE_MISS,	// id: DAGタスクのid, arg0: ジョブのハンドル, arg1: 遅れ（ns）
+	BPF_DAG_EVENT_ERROR,		// id: DAGタスクの識別番号（src nodeのtid）, arg0: メッセージの種類, arg1: エラーコード
+};
+
+struct bpf_dag_event {
+	u32 type; // enum bpf_dag_event_type
+	u32 id;
+	u64 ts; // bpf_ktime_get_ns()
+	u64 arg0;
+	s64 arg1;
+};
+
 #endif /* __MY_OPS_KFUNCS_H */
@@ -6,11 +6,15 @@ char LICENSE[] SEC("license") = "GPL";
 
 u64 cnt = 0;
 
+// The number of the assertions failed by the last my_ops_calculate, which returns it to my_ops/ctl
+u64 nr_assert_failures = 0;
+
 #define assert(cond)						\
 	do {							\
 		if (!(cond)) {					\
 			bpf_printk("%s:%d assertion failed",	\
 				__FILE__, __LINE__);		\
+			__sync_fetch_and_add(&nr_assert_failures, 1); \
 		}						\
 	} while (0)
 
@@ -19,6 +23,7 @@ u64 cnt = 0;
 		if (!(cond)) {					\
 			bpf_printk("%s:%d assertion failed",	\
 				__FILE__, __LINE__);		\
+			__sync_fetch_and_add(&nr_assert_failures, 1); \
 			return;					\
 		}						\
 	} while (0)
@@ -28,11 +33,14 @@ u64 cnt = 0;
 		if (!(cond)) {					\
 			bpf_printk("%s:%d assertion failed",	\
 				__FILE__, __LINE__);		\
+			__sync_fetch_and_add(&nr_assert_failures, 1); \
 			return -1;				\
 		}						\
 	} while (0)
 
-#define BPF_DAG_TASK_LIMIT 10
+// The size of dag_tasks. This should be at least the max_dag_tasks module
+// parameter of dag_bpf.ko.
+#define BPF_DAG_TASK_LIMIT 1024
 
 struct dag_tasks_map_value {
 	struct bpf_dag_task __kptr *dag_task;
@@ -53,9 +61,89 @@ struct {
 	__uint(max_entries, USER_RINGBUF_SIZE);
 } urb SEC(".maps");
 
+struct bulk_graph_buf {
+	u8 data[BPF_DAG_MSG_BULK_GRAPH_MAX_SIZE];
+};
+
+// The staging buffer of BPF_DAG_MSG_BULK_GRAPH. The user ring buffer is drained
+// by one CPU at a time, so a single entry is enough.
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct bulk_graph_buf);
+} bulk_graph_buf SEC(".maps");
+
+// Typed events for userspace, struct bpf_dag_event. Read with bpf_comm::ring_buffer::RingBuffer.
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+} dag_events SEC(".maps");
+
+// The results of the urb messages, struct bpf_dag_msg_ack, in the order of the messages.
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 256 * 1024);
+} dag_acks SEC(".maps");
+
+// Text tracing (bpf_printk and bpf_dag_task_dump) is opt-in. Set by the loader.
+const volatile bool verbose = false;
+
+#define verbose_printk(fmt, ...)				\
+	do {							\
+		if (verbose)					\
+			bpf_printk(fmt, ##__VA_ARGS__);		\
+	} while (0)
+
+/*
+ * Writes an event to the events ring buffer. The event is dropped if the ring
+ * buffer is full.
+ */
+static void emit_event(u32 type, u32 id, u64 arg0, s64 arg1)
+{
+	struct bpf_dag_event *event;
+
+	event = bpf_ringbuf_reserve(&dag_events, sizeof(*event), 0);
+	if (!event)
+		return;
+
+	event->type = type;
+	event->id = id;
+	event->ts = bpf_ktime_get_ns();
+	event->arg0 = arg0;
+	event->arg1 = arg1;
+	bpf_ringbuf_submit(event, 0);
+}
+
+// The runtime estimates of the DAG nodes, keyed by tid. Read by task-stat-scanner.
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 8192);
+	__type(key, s32);
+	__type(value, struct bpf_dag_runtime_est);
+} est_ctx SEC(".maps");
+
+/*
+ * Copies the runtime estimate of the node @tid of @dag_task into est_ctx.
+ */
+static long publish_runtime_est(struct bpf_dag_task *dag_task, s32 tid)
+{
+	struct bpf_dag_runtime_est est;
+	s32 node_id;
+
+	node_id = bpf_dag_task_get_node_id(dag_task, tid);
+	if (node_id < 0)
+		return -1;
+
+	if (bpf_dag_task_get_runtime_est(dag_task, node_id, &est))
+		return -1;
+
+	return bpf_map_update_elem(&est_ctx, &tid, &est, BPF_ANY);
+}
+
 static long handle_new_dag_task(struct bpf_dag_msg_new_task_payload *payload)
 {
-	s32 key, ret;
+	s32 key, ret, id;
 	void *value;
 	struct bpf_dag_task *dag_task, *old;
 	long status;
@@ -63,11 +151,13 @@ static long handle_new_dag_task(struct bpf_dag_msg_new_task_payload *payload)
 
 	dag_task = bpf_dag_task_alloc(payload->src_node_tid, payload->src_node_weight, 10, 10);
 	if (!dag_task) {
-		bpf_printk("Failed to newly allocate a DAG task (src_node_tid=%d).", payload->src_node_tid);
-		return 1;
+		verbose_printk("Failed to newly allocate a DAG task (src_node_tid=%d).", payload->src_node_tid);
+		emit_event(BPF_DAG_EVENT_ERROR, payload->src_node_tid, BPF_DAG_MSG_NEW_TASK, -1);
+		return -1;
 	}
 
-	bpf_printk("Successfully allocates a DAG-task! tid=%d, id=%d", payload->src_node_tid, dag_task->id);
+	verbose_printk("Successfully allocates a DAG-task! tid=%d, id=%d", payload->src_node_tid, dag_task->id);
+	emit_event(BPF_DAG_EVENT_GRAPH_CHANGE, dag_task->id, BPF_DAG_MSG_NEW_TASK, 0);
 
 	ret = bpf_dag_task_set_weight(dag_task, 0, 42);
 	assert(!ret);
@@ -80,24 +170,25 @@ static long handle_new_dag_task(struct bpf_dag_msg_new_task_payload *payload)
 	local.dag_task = NULL;
 	status = bpf_map_update_elem(&dag_tasks, &key, &local, 0);
 	if (status) {
-		bpf_printk("Failed to update dag_tasks's elem with NULL value");
+		verbose_printk("Failed to update dag_tasks's elem with NULL value");
 		bpf_dag_task_free(dag_task);
-		return 1;
+		return -1;
 	}
 
 	v = bpf_map_lookup_elem(&dag_tasks, &key);
 	if (!v) {
-		bpf_printk("Failed to lookup dag_tasks's elem");
+		verbose_printk("Failed to lookup dag_tasks's elem");
 		bpf_dag_task_free(dag_task);
-		return 1;
+		return -1;
 	}
 
+	id = dag_task->id;
 	old = bpf_kptr_xchg(&v->dag_task, dag_task);
 
 	if (old)
 		bpf_dag_task_free(old);
 
-	return 0;
+	return id;
 }
 
 static inline long handle_add_node(struct bpf_dag_msg_add_node_payload *payload)
@@ -110,26 +201,31 @@ static inline long handle_add_node(struct bpf_dag_msg_add_node_payload *payload)
 	key = payload->dag_task_id;
 	v = bpf_map_lookup_elem(&dag_tasks, &key);
 	if (!v) {
-		bpf_printk("There is no entry in dag_tasks with key=%d", key);
+		verbose_printk("There is no entry in dag_tasks with key=%d", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_NODE, -1);
 		return -1;
 	}
 
 	dag_task = bpf_kptr_xchg(&v->dag_task, NULL); // acquire ownership
 	if (!dag_task) {
-		bpf_printk("dag_tasks[%d]->dag_task is NULL", key);
+		verbose_printk("dag_tasks[%d]->dag_task is NULL", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_NODE, -1);
 		return -1;
 	}
 
 	node_id = bpf_dag_task_add_node(dag_task, payload->tid, payload->weight);
 
-	bpf_dag_task_dump(dag_task);
+	if (verbose)
+		bpf_dag_task_dump(dag_task);
 
 	if (node_id >= 0) {
-		bpf_printk("Successfully add a node (tid=%d, node_id=%d) to a DAG-task (id=%d)",
+		verbose_printk("Successfully add a node (tid=%d, node_id=%d) to a DAG-task (id=%d)",
 			payload->tid, node_id, dag_task->id);
+		emit_event(BPF_DAG_EVENT_GRAPH_CHANGE, dag_task->id, BPF_DAG_MSG_ADD_NODE, node_id);
 	} else {
-		bpf_printk("Failed to add a node (tid=%d) to a DAG-task (id=%d)",
+		verbose_printk("Failed to add a node (tid=%d) to a DAG-task (id=%d)",
 			payload->tid, dag_task->id);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_NODE, node_id);
 	}
 
 	old = bpf_kptr_xchg(&v->dag_task, dag_task);
@@ -137,7 +233,7 @@ static inline long handle_add_node(struct bpf_dag_msg_add_node_payload *payload)
 	if (old)
 		bpf_dag_task_free(old);
 
-	return 0;
+	return node_id;
 }
 
 static inline long handle_add_edge(struct bpf_dag_msg_add_edge_payload *payload)
@@ -150,26 +246,31 @@ static inline long handle_add_edge(struct bpf_dag_msg_add_edge_payload *payload)
 	key = payload->dag_task_id;
 	v = bpf_map_lookup_elem(&dag_tasks, &key);
 	if (!v) {
-		bpf_printk("There is no entry in dag_tasks with key=%d", key);
+		verbose_printk("There is no entry in dag_tasks with key=%d", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_EDGE, -1);
 		return -1;
 	}
 
 	dag_task = bpf_kptr_xchg(&v->dag_task, NULL); // acquire ownership
 	if (!dag_task) {
-		bpf_printk("dag_tasks[%d]->dag_task is NULL", key);
+		verbose_printk("dag_tasks[%d]->dag_task is NULL", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_EDGE, -1);
 		return -1;
 	}
 
 	edge_id = bpf_dag_task_add_edge(dag_task, payload->from_tid, payload->to_tid);
 
-	bpf_dag_task_dump(dag_task);
+	if (verbose)
+		bpf_dag_task_dump(dag_task);
 
 	if (edge_id >= 0) {
-		bpf_printk("Successfully add a edge (%d -> %d, edge_id=%d) to a DAG-task (id=%d)",
+		verbose_printk("Successfully add a edge (%d -> %d, edge_id=%d) to a DAG-task (id=%d)",
 			payload->from_tid, payload->to_tid, edge_id, dag_task->id);
+		emit_event(BPF_DAG_EVENT_GRAPH_CHANGE, dag_task->id, BPF_DAG_MSG_ADD_EDGE, edge_id);
 	} else {
-		bpf_printk("Failed to add a edge (%d -> %d) to a DAG-task (id=%d)",
+		verbose_printk("Failed to add a edge (%d -> %d) to a DAG-task (id=%d)",
 			payload->from_tid, payload->to_tid, dag_task->id);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_ADD_EDGE, edge_id);
 	}
 
 	old = bpf_kptr_xchg(&v->dag_task, dag_task);
@@ -177,70 +278,181 @@ static inline long handle_add_edge(struct bpf_dag_msg_add_edge_payload *payload)
 	if (old)
 		bpf_dag_task_free(old);
 
-	return 0;
+	return edge_id;
 }
 
+static inline long handle_commit(struct bpf_dag_msg_commit_payload *payload)
+{
+	s32 key, err;
+	struct bpf_dag_task *dag_task, *old;
+	struct dag_tasks_map_value *v;
+
+	key = payload->dag_task_id;
+	v = bpf_map_lookup_elem(&dag_tasks, &key);
+	if (!v) {
+		verbose_printk("There is no entry in dag_tasks with key=%d", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_COMMIT, -1);
+		return -1;
+	}
+
+	dag_task = bpf_kptr_xchg(&v->dag_task, NULL); // acquire ownership
+	if (!dag_task) {
+		verbose_printk("dag_tasks[%d]->dag_task is NULL", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_COMMIT, -1);
+		return -1;
+	}
+
+	err = bpf_dag_task_commit(dag_task);
+	if (!err) {
+		verbose_printk("Successfully commit a DAG-task (id=%d)", dag_task->id);
+		emit_event(BPF_DAG_EVENT_GRAPH_CHANGE, dag_task->id, BPF_DAG_MSG_COMMIT, 0);
+	} else {
+		verbose_printk("Failed to commit a DAG-task (id=%d, err=%d)", dag_task->id, err);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_COMMIT, err);
+	}
+
+	old = bpf_kptr_xchg(&v->dag_task, dag_task);
+
+	if (old)
+		bpf_dag_task_free(old);
+
+	return err;
+}
+
+static long handle_bulk_graph(struct bpf_dynptr *dynptr)
+{
+	struct bpf_dag_task *dag_task, *old;
+	struct dag_tasks_map_value local, *v;
+	struct bulk_graph_buf *buf;
+	u32 zero = 0, size;
+	s32 key, id;
+
+	buf = bpf_map_lookup_elem(&bulk_graph_buf, &zero);
+	if (!buf)
+		return -1;
+
+	size = bpf_dynptr_size(dynptr) - sizeof(struct bpf_dag_msg_header);
+	if (size < sizeof(struct bpf_dag_bulk_graph) + sizeof(struct bpf_dag_bulk_node) ||
+	    size > sizeof(buf->data)) {
+		verbose_printk("Invalid size of a bulk graph message (%u)", size);
+		return -1;
+	}
+
+	if (bpf_dynptr_read(buf->data, size, dynptr, sizeof(struct bpf_dag_msg_header), 0)) {
+		verbose_printk("Failed to drain message bulk graph.");
+		return -1;
+	}
+
+	// dag_tasks is keyed by the tid of the source node
+	key = ((struct bpf_dag_bulk_node *)(buf->data + sizeof(struct bpf_dag_bulk_graph)))->tid;
+
+	dag_task = bpf_dag_task_alloc_bulk((struct bpf_dag_bulk_graph *)buf->data, size);
+	if (!dag_task) {
+		verbose_printk("Failed to install a bulk graph (src_node_tid=%d).", key);
+		emit_event(BPF_DAG_EVENT_ERROR, key, BPF_DAG_MSG_BULK_GRAPH, -1);
+		return -1;
+	}
+
+	local.dag_task = NULL;
+	if (bpf_map_update_elem(&dag_tasks, &key, &local, 0)) {
+		bpf_dag_task_free(dag_task);
+		return -1;
+	}
+
+	v = bpf_map_lookup_elem(&dag_tasks, &key);
+	if (!v) {
+		bpf_dag_task_free(dag_task);
+		return -1;
+	}
+
+	verbose_printk("Successfully install a bulk graph (src_node_tid=%d, id=%d)", key, dag_task->id);
+	emit_event(BPF_DAG_EVENT_GRAPH_CHANGE, dag_task->id, BPF_DAG_MSG_BULK_GRAPH, 0);
+
+	id = dag_task->id;
+	old = bpf_kptr_xchg(&v->dag_task, dag_task);
+	if (old)
+		bpf_dag_task_free(old);
+
+	return id;
+}
+
+/*
+ * Posts the result of the message @hdr to dag_acks. @ret is the value returned by
+ * its handler: the id of what was created if it's not negative, otherwise an error.
+ * The ack is dropped if dag_acks is full, and userspace detects it by the gap
+ * in the sequence numbers.
+ */
+static void post_ack(struct bpf_dag_msg_header *hdr, s64 ret)
+{
+	struct bpf_dag_msg_ack ack = {
+		.seq = hdr->seq,
+		.type = hdr->type,
+		.ret = ret,
+	};
+
+	bpf_ringbuf_output(&dag_acks, &ack, sizeof(ack), 0);
+}
+
+/*
+ * Reads the payload following the message header in @dynptr into @payload.
+ */
+#define read_payload(payload, dynptr)						\
+	bpf_dynptr_read(payload, sizeof(*(payload)), dynptr, sizeof(struct bpf_dag_msg_header), 0)
+
+/*
+ * Handles a message. A message that fails is acknowledged with an error and
+ * draining goes on, so one bad message doesn't hold back the ones after it.
+ */
 static long user_ringbuf_callback(struct bpf_dynptr *dynptr, void *ctx)
 {
-	long err;
-	enum bpf_dag_msg_type type;
-	struct bpf_dag_task *dag_task;
+	struct bpf_dag_msg_header hdr;
+	long ret;
 
-	err = bpf_dynptr_read(&type, sizeof(type), dynptr, 0, 0);
-	if (err) {
-		bpf_printk("Failed to drain message type.");
-		return 1; // stop continuing
+	if (bpf_dynptr_read(&hdr, sizeof(hdr), dynptr, 0, 0)) {
+		verbose_printk("Failed to drain message header.");
+		return 1; // stop continuing, there is no sequence number to acknowledge
 	}
 
-	if (type == BPF_DAG_MSG_NEW_TASK) {
+	if (hdr.type == BPF_DAG_MSG_NEW_TASK) {
 		struct bpf_dag_msg_new_task_payload payload;
 
-		err = bpf_dynptr_read(&payload, sizeof(payload), dynptr, sizeof(type), 0);
-		if (err) {
-			bpf_printk("Failed to drain message new task type.");
-			return 1; // stop continuing
-		}
-		
-		err = handle_new_dag_task(&payload);
-		if (err) {
-			bpf_printk("Failed to handle a new dag task message");
-			return 1;
-		}
+		ret = read_payload(&payload, dynptr);
+		if (!ret)
+			ret = handle_new_dag_task(&payload);
 
-	} else if (type == BPF_DAG_MSG_ADD_NODE) {
+	} else if (hdr.type == BPF_DAG_MSG_ADD_NODE) {
 		struct bpf_dag_msg_add_node_payload payload;
 
-		err = bpf_dynptr_read(&payload, sizeof(payload), dynptr, sizeof(type), 0);
-		if (err) {
-			bpf_printk("Failed to drain message add node.");
-			return 1; // stop continuing
-		}
-		
-		err = handle_add_node(&payload);
-		if (err) {
-			bpf_printk("Failed to handle add_node message");
-			return 1;
-		}
+		ret = read_payload(&payload, dynptr);
+		if (!ret)
+			ret = handle_add_node(&payload);
 
-	} else if (type == BPF_DAG_MSG_ADD_EDGE) {
+	} else if (hdr.type == BPF_DAG_MSG_ADD_EDGE) {
 		struct bpf_dag_msg_add_edge_payload payload;
 
-		err = bpf_dynptr_read(&payload, sizeof(payload), dynptr, sizeof(type), 0);
-		if (err) {
-			bpf_printk("Failed to drain message add edge.");
-			return 1; // stop continuing
-		}
-		
-		err = handle_add_edge(&payload);
-		if (err) {
-			bpf_printk("Failed to handle add_edge message");
-			return 1;
-		}
+		ret = read_payload(&payload, dynptr);
+		if (!ret)
+			ret = handle_add_edge(&payload);
+
+	} else if (hdr.type == BPF_DAG_MSG_COMMIT) {
+		struct bpf_dag_msg_commit_payload payload;
+
+		ret = read_payload(&payload, dynptr);
+		if (!ret)
+			ret = handle_commit(&payload);
+
+	} else if (hdr.type == BPF_DAG_MSG_BULK_GRAPH) {
+		ret = handle_bulk_graph(dynptr);
 
 	} else {
-		bpf_printk("[ WARN ] Unknown message type: BPF_DAG_MSG_?=%d", type);
+		verbose_printk("[ WARN ] Unknown message type: BPF_DAG_MSG_?=%d", hdr.type);
+		ret = -1;
 	}
 
+	if (ret < 0)
+		verbose_printk("Failed to handle a message (type=%d, seq=%llu, ret=%ld)", hdr.type, hdr.seq, ret);
+	post_ack(&hdr, ret);
+
 	return 0;
 }
 
@@ -263,7 +475,7 @@ static void test_invalid_dag_task(void)
 	bpf_dag_task_free(dag_task);
 }
 
-static void test_invalid_dag_task2(void)
+static void test_large_dag_task(void)
 {
 	s32 ret, i = 0;
 	struct bpf_dag_task *dag_task;
@@ -274,14 +486,29 @@ static void test_invalid_dag_task2(void)
 		return;
 	}
 
+	/*
+	 * 1000 --> 1001 --> 1002 --> ... --> 2000
+	 */
 	bpf_for(i, 0, 1000) {
-		ret = bpf_dag_task_add_node(dag_task, 1001 + i, 0);
+		ret = bpf_dag_task_add_node(dag_task, 1001 + i, 1);
 		if (ret < 0) {
 			bpf_printk("bpf_for breaks at i=%d", i);
 			break;
 		}
 	}
-	assert(ret < 0);
+	assert(ret == 1000);
+
+	bpf_for(i, 0, 1000) {
+		ret = bpf_dag_task_add_edge(dag_task, 1000 + i, 1001 + i);
+		if (ret < 0) {
+			bpf_printk("bpf_for breaks at i=%d", i);
+			break;
+		}
+	}
+	assert(ret == 999);
+
+	bpf_dag_task_culc_HLBS_prio(dag_task);
+	assert(bpf_dag_task_get_prio(dag_task, 0) < bpf_dag_task_get_prio(dag_task, 1000));
 
 	bpf_dag_task_free(dag_task);
 }
@@ -314,6 +541,83 @@ static void test_invalid_dag_task3(void)
 	ret = bpf_dag_task_add_edge(dag_task, 8888, 1000); // invalid node!
 	assert(ret < 0);
 
+	assert(bpf_dag_task_get_node_id(dag_task, 1000) == 0);
+	assert(bpf_dag_task_get_node_id(dag_task, 1002) == 2);
+	assert(bpf_dag_task_get_node_id(dag_task, 8888) < 0);
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_commit(void)
+{
+	struct bpf_dag_task *dag_task;
+
+	/*
+	 * 1000 --+--> 1001
+	 *        |
+	 *        +--> 1002
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 10, 10);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 1) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 1) == 2);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_commit(dag_task) < 0); // 1002 isn't reachable from 1000
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	assert(bpf_dag_task_commit(dag_task) < 0); // already committed
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) < 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1002) < 0);
+
+	bpf_dag_task_culc_HELT_prio(dag_task);
+	assert(bpf_dag_task_get_node_id(dag_task, 1002) == 2);
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_alloc_bulk(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct {
+		struct bpf_dag_bulk_graph hdr;
+		struct bpf_dag_bulk_node nodes[4];
+		struct edge_info edges[4];
+	} graph = {
+		.hdr = { .nr_nodes = 4, .nr_edges = 4, .relative_deadline = 100, .period = 200 },
+		.nodes = { { 1000, 1 }, { 1001, 3 }, { 1002, 1 }, { 1003, 2 } },
+		.edges = { { 0, 1 }, { 0, 2 }, { 1, 3 }, { 2, 3 } },
+	};
+
+	/*
+	 * 1000(1) --+--> 1001(3) --+
+	 *           |              +--> 1003(2)
+	 *           +--> 1002(1) --+
+	 */
+	dag_task = bpf_dag_task_alloc_bulk(&graph.hdr, sizeof(graph));
+	assert_ret(dag_task);
+	assert(dag_task->committed);
+	assert(dag_task->nr_nodes == 4 && dag_task->nr_edges == 4);
+	assert(dag_task->relative_deadline == 100 && dag_task->period == 200);
+	assert(bpf_dag_task_get_node_id(dag_task, 1003) == 3);
+	assert(bpf_dag_task_get_weight(dag_task, 1) == 3);
+	assert(bpf_dag_task_get_volume(dag_task) == 7);
+	assert(bpf_dag_task_get_critical_path(dag_task) == 6);
+	bpf_dag_task_free(dag_task);
+
+	// truncated
+	assert(!bpf_dag_task_alloc_bulk(&graph.hdr, sizeof(graph) - sizeof(struct edge_info)));
+
+	graph.edges[3].to = 4; // out of range
+	assert(!bpf_dag_task_alloc_bulk(&graph.hdr, sizeof(graph)));
+
+	graph.edges[3].from = 3;
+	graph.edges[3].to = 2; // violates the topological order
+	assert(!bpf_dag_task_alloc_bulk(&graph.hdr, sizeof(graph)));
+
+	graph.hdr.nr_edges = 3; // without the bad edge, 1003 is still reachable via 1001
+	dag_task = bpf_dag_task_alloc_bulk(&graph.hdr, sizeof(graph));
+	assert_ret(dag_task);
 	bpf_dag_task_free(dag_task);
 }
 
@@ -329,14 +633,12 @@ static void test_culc_HELT_prio(void)
 	 *           |                                            +--> 1006(1)
 	 *           +--> 1003(2) --------------------------------+
 	 *
-	 * expected result:
-	 *	1000's prio: 7
-	 *	1001's prio: 6
-	 *	1002's prio: 4
-	 *	1003's prio: 3
-	 *	1004's prio: 3
-	 *	1005's prio: 2
-	 *	1006's prio: 1
+	 * expected ranks:
+	 *	1000: 7, 1001: 6, 1002: 4, 1003: 3, 1004: 3, 1005: 2, 1006: 1
+	 *
+	 * expected result (from the highest priority):
+	 *	1000, 1001, 1002, 1004, 1003, 1005, 1006
+	 *	(1003 and 1004 have the same rank, and ties go to the larger node id)
 	 */
 	dag_task = bpf_dag_task_alloc(1000, 1, 10, 10);
 	assert_ret(dag_task);
@@ -360,6 +662,13 @@ static void test_culc_HELT_prio(void)
 	bpf_dag_task_culc_HELT_prio(dag_task);
 	bpf_dag_task_dump(dag_task);
 
+	assert(bpf_dag_task_get_prio(dag_task, 0) < bpf_dag_task_get_prio(dag_task, 1));
+	assert(bpf_dag_task_get_prio(dag_task, 1) < bpf_dag_task_get_prio(dag_task, 2));
+	assert(bpf_dag_task_get_prio(dag_task, 2) < bpf_dag_task_get_prio(dag_task, 4));
+	assert(bpf_dag_task_get_prio(dag_task, 4) < bpf_dag_task_get_prio(dag_task, 3));
+	assert(bpf_dag_task_get_prio(dag_task, 3) < bpf_dag_task_get_prio(dag_task, 5));
+	assert(bpf_dag_task_get_prio(dag_task, 5) < bpf_dag_task_get_prio(dag_task, 6));
+
 	bpf_dag_task_free(dag_task);
 }
 
@@ -375,14 +684,13 @@ static void test_culc_HLBS_prio(void)
 	 *           |                                            +--> 1006(1)
 	 *           +--> 1003(2) --------------------------------+
 	 *
-	 * expected result:
-	 *	1000's prio: 3
-	 *	1001's prio: 4
-	 *	1002's prio: 6
-	 *	1003's prio: 7
-	 *	1004's prio: 7
-	 *	1005's prio: 8
-	 *	1006's prio: 9
+	 * expected latest start times (relative to the release):
+	 *	1000: 3, 1001: 4, 1002: 6, 1003: 7, 1004: 7, 1005: 8, 1006: 9
+	 *
+	 * expected result (from the highest priority):
+	 *	1000, 1001, 1002, 1003, 1004, 1005, 1006
+	 *	(all of them share a unit of the priority key, so the ranks must
+	 *	follow the exact latest start times; ties go to the smaller node id)
 	 */
 	dag_task = bpf_dag_task_alloc(1000, 1, 10, 123);
 	assert_ret(dag_task);
@@ -407,11 +715,359 @@ static void test_culc_HLBS_prio(void)
 
 	bpf_dag_task_dump(dag_task);
 
+	for (i = 0; i < 6; i++)
+		assert(bpf_dag_task_get_prio(dag_task, i) < bpf_dag_task_get_prio(dag_task, i + 1));
+
 	bpf_dag_task_free(dag_task);
 }
 
+static void test_slack(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct bpf_dag_node_slack slack;
+
+	/*
+	 * 1000(1) -----> 1001(2) -----> 1003(1)
+	 *    |                             ^
+	 *    +---------> 1002(5) ----------+
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 100, 100);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 2) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 5) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_task_get_slack(dag_task, 0, &slack) < 0); // not computed yet
+
+	assert(bpf_dag_task_culc_slack(dag_task) == 0);
+	assert(bpf_dag_task_get_slack(dag_task, 0, &slack) == 0);
+	assert(slack.earliest_start == 0 && slack.latest_start == 93 && slack.slack == 93);
+	assert(bpf_dag_task_get_slack(dag_task, 1, &slack) == 0);
+	assert(slack.earliest_start == 1 && slack.latest_start == 97 && slack.slack == 96);
+	assert(bpf_dag_task_get_slack(dag_task, 2, &slack) == 0);
+	assert(slack.earliest_start == 1 && slack.latest_start == 94 && slack.slack == 93);
+	assert(bpf_dag_task_get_slack(dag_task, 3, &slack) == 0);
+	assert(slack.earliest_start == 6 && slack.latest_start == 99 && slack.slack == 93);
+	assert(bpf_dag_task_get_slack(dag_task, 4, &slack) < 0);
+
+	/*
+	 * A weight change makes them stale until they are computed again.
+	 */
+	assert(bpf_dag_task_set_weight(dag_task, 2, 1) == 0);
+	assert(bpf_dag_task_get_slack(dag_task, 2, &slack) < 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	assert(bpf_dag_task_culc_slack(dag_task) == 0);
+	assert(bpf_dag_task_get_slack(dag_task, 1, &slack) == 0);
+	assert(slack.slack == 96);
+	assert(bpf_dag_task_get_slack(dag_task, 0, &slack) == 0);
+	assert(slack.latest_start == 96 && slack.slack == 96);
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_federated(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct bpf_dag_weight_update updates[2] = {
+		{ .node_id = 1, .weight = 2 },
+		{ .node_id = 2, .weight = 8 },
+	};
+
+	/*
+	 * 1000(4) -----> 1001(4) -----> 1003(4)
+	 *    |                             ^
+	 *    +---------> 1002(4) ----------+
+	 * C = 16, L = 12 and D = 14, so it is heavy and needs
+	 * ceil((16 - 12) / (14 - 12)) = 2 cores.
+	 *
+	 * bpf_dag_task_federated_assign() isn't called here, since it would
+	 * reassign the cores of every DAG task alive in the system.
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 4, 14, 14);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 4) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 4) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 4) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_task_get_volume(dag_task) == 16);
+	assert(bpf_dag_task_get_critical_path(dag_task) == 12);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+
+	/*
+	 * C and L follow the weights after commit. With L = D the deadline
+	 * can't be met.
+	 */
+	assert(bpf_dag_task_set_weight(dag_task, 2, 6) == 0);
+	assert(bpf_dag_task_get_volume(dag_task) == 18);
+	assert(bpf_dag_task_get_critical_path(dag_task) == 14);
+
+	/*
+	 * The longest path moves to 1000 -> 1002 -> 1003.
+	 */
+	assert(bpf_dag_task_set_weights(dag_task, updates, sizeof(updates)) == 0);
+	assert(bpf_dag_task_get_volume(dag_task) == 18);
+	assert(bpf_dag_task_get_critical_path(dag_task) == 16);
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_incremental_prio(void)
+{
+	struct bpf_dag_task *dag_task;
+	s64 incr[4];
+
+	/*
+	 * 1000(1) --+--> 1001(1) --+
+	 *           |              +--> 1003(1)
+	 *           +--> 1002(1) --+
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 10, 10);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 1) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 1) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+
+	/*
+	 * HELT: 1001 and 1002 have the same rank, and ties go to the larger node id.
+	 */
+	bpf_dag_task_culc_HELT_prio(dag_task);
+	assert(bpf_dag_task_get_prio(dag_task, 2) < bpf_dag_task_get_prio(dag_task, 1));
+
+	assert(bpf_dag_task_set_weight(dag_task, 1, 5) == 0);
+	assert(bpf_dag_task_get_prio(dag_task, 1) < bpf_dag_task_get_prio(dag_task, 2));
+	assert(bpf_dag_task_get_prio(dag_task, 0) < bpf_dag_task_get_prio(dag_task, 1));
+
+	/*
+	 * The incremental result must match a full recomputation.
+	 * The deadline changes, but the ranks must not.
+	 */
+	for (int i = 0; i < 4; i++)
+		incr[i] = bpf_dag_prio_decode_rank(bpf_dag_task_get_prio(dag_task, i));
+	bpf_dag_task_culc_HELT_prio(dag_task);
+	for (int i = 0; i < 4; i++)
+		assert(incr[i] == bpf_dag_prio_decode_rank(bpf_dag_task_get_prio(dag_task, i)));
+
+	/*
+	 * HLBS
+	 */
+	bpf_dag_task_culc_HLBS_prio(dag_task);
+	assert(bpf_dag_task_set_weight(dag_task, 2, 9) == 0);
+	assert(bpf_dag_task_get_prio(dag_task, 2) < bpf_dag_task_get_prio(dag_task, 1));
+
+	/*
+	 * The deadline changes, but the order of the nodes must not.
+	 */
+	for (int i = 0; i < 4; i++)
+		incr[i] = bpf_dag_task_get_prio(dag_task, i);
+	bpf_dag_task_culc_HLBS_prio(dag_task);
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++)
+			assert((incr[i] < incr[j]) == (bpf_dag_task_get_prio(dag_task, i) < bpf_dag_task_get_prio(dag_task, j)));
+	}
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_set_weights(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct bpf_dag_weight_update updates[2] = {
+		{ .node_id = 1, .weight = 5 },
+		{ .node_id = 2, .weight = 9 },
+	};
+	struct bpf_dag_weight_update invalid[1] = {
+		{ .node_id = 4, .weight = 1 },
+	};
+
+	/*
+	 * 1000(1) --+--> 1001(1) --+
+	 *           |              +--> 1003(1)
+	 *           +--> 1002(1) --+
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 10, 10);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 1) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 1) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+
+	bpf_dag_task_culc_HLBS_prio(dag_task);
+
+	assert(bpf_dag_task_set_weights(dag_task, invalid, sizeof(invalid)) < 0);
+
+	/*
+	 * 1001, 1002 and 1000 change, 1003 doesn't.
+	 */
+	assert(bpf_dag_task_set_weights(dag_task, updates, sizeof(updates)) == 3);
+	assert(bpf_dag_task_get_weight(dag_task, 1) == 5);
+	assert(bpf_dag_task_get_weight(dag_task, 2) == 9);
+	assert(bpf_dag_task_get_prio(dag_task, 2) < bpf_dag_task_get_prio(dag_task, 1));
+
+	assert(bpf_dag_task_set_weights(dag_task, updates, sizeof(updates)) == 0); // nothing changes
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_jobs(void)
+{
+	struct bpf_dag_task *dag_task;
+	s64 job1, job2, job;
+	s32 i;
+
+	/*
+	 * 1000(1) -----> 1001(2)
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 100000, 100000);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 2) == 1);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_job_release(dag_task) < 0); // not committed yet
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	assert(bpf_dag_task_job_release(dag_task) < 0); // no priorities yet
+
+	bpf_dag_task_culc_HELT_prio(dag_task);
+
+	/*
+	 * Job 2 is released before job 1 completes. Job 1 keeps its deadline.
+	 */
+	job1 = bpf_dag_task_job_release(dag_task);
+	assert(job1 > 0);
+	job2 = bpf_dag_task_job_release(dag_task);
+	assert(job2 > job1);
+	assert(bpf_dag_task_job_get_deadline(dag_task, job1) <= bpf_dag_task_job_get_deadline(dag_task, job2));
+	assert(bpf_dag_task_job_get_prio(dag_task, job1, 1) <= bpf_dag_task_job_get_prio(dag_task, job2, 1));
+	assert(bpf_dag_task_job_get_prio(dag_task, job1, 0) < bpf_dag_task_job_get_prio(dag_task, job1, 1));
+	assert(bpf_dag_task_job_get_prio(dag_task, job1, 2) < 0);
+
+	assert(bpf_dag_task_job_complete(dag_task, job1) == 0);
+	assert(bpf_dag_task_job_complete(dag_task, job1) < 0);
+	assert(bpf_dag_task_job_get_prio(dag_task, job1, 0) < 0);
+	assert(bpf_dag_task_job_get_deadline(dag_task, job2) > 0);
+
+	/*
+	 * The ring is full once DAG_TASK_MAX_JOBS (8) jobs are active.
+	 */
+	bpf_for(i, 0, 7) {
+		job = bpf_dag_task_job_release(dag_task);
+		if (job < 0)
+			break;
+	}
+	assert(job > 0);
+	assert(bpf_dag_task_job_release(dag_task) < 0);
+	assert(bpf_dag_task_job_complete(dag_task, job2) == 0);
+	assert(bpf_dag_task_job_release(dag_task) > 0);
+
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_prio_encoding(void)
+{
+	s64 prio;
+
+	prio = bpf_dag_prio_encode(123 << 14, 7, 45);
+	assert(bpf_dag_prio_decode_time(prio) == 123 << 14);
+	assert(bpf_dag_prio_decode_dag(prio) == 7);
+	assert(bpf_dag_prio_decode_rank(prio) == 45);
+
+	/*
+	 * An earlier deadline always wins, whatever the DAG tasks and the ranks are.
+	 */
+	assert(bpf_dag_prio_encode(1000 << 14, 1023, 0x1fff) < bpf_dag_prio_encode(1001 << 14, 0, 0));
+	/*
+	 * Within the same unit of time, the DAG task comes before the rank.
+	 */
+	assert(bpf_dag_prio_encode(1000 << 14, 1, 0x1fff) < bpf_dag_prio_encode(1000 << 14, 2, 0));
+	assert(bpf_dag_prio_encode(1000 << 14, 1, 1) < bpf_dag_prio_encode(1000 << 14, 1, 2));
+	assert(bpf_dag_prio_encode(-1, 0, 0) >= 0);
+}
+
+static struct bpf_dag_task *alloc_chain(u32 tid)
+{
+	struct bpf_dag_task *dag_task;
+
+	dag_task = bpf_dag_task_alloc(tid, 1, 100000, 100000);
+	if (!dag_task)
+		return NULL;
+
+	assert(bpf_dag_task_add_node(dag_task, tid + 1, 1) == 1);
+	assert(bpf_dag_task_add_node(dag_task, tid + 2, 1) == 2);
+	assert(bpf_dag_task_add_edge(dag_task, tid, tid + 1) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, tid + 1, tid + 2) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	return dag_task;
+}
+
+static void test_prio_same_unit(void)
+{
+	struct bpf_dag_task *a, *b;
+	s64 a_min = 0x7fffffffffffffffLL, a_max = -1;
+	s64 b_min = 0x7fffffffffffffffLL, b_max = -1;
+	s64 prio;
+	int i;
+
+	/*
+	 * 2000 -> 2001 -> 2002 and 3000 -> 3001 -> 3002 with the same relative
+	 * deadline. Computed back to back, their deadlines fall in the same unit
+	 * of the key (retried in case they straddle a boundary).
+	 */
+	a = alloc_chain(2000);
+	assert_ret(a);
+	b = alloc_chain(3000);
+	if (!b) {
+		bpf_dag_task_free(a);
+		assert_ret(b);
+	}
+
+	for (i = 0; i < 3; i++) {
+		bpf_dag_task_culc_HELT_prio(a);
+		bpf_dag_task_culc_HELT_prio(b);
+		if (bpf_dag_prio_decode_time(bpf_dag_task_get_prio(a, 0)) ==
+		    bpf_dag_prio_decode_time(bpf_dag_task_get_prio(b, 0)))
+			break;
+	}
+	assert(i < 3);
+
+	for (i = 0; i < 3; i++) {
+		prio = bpf_dag_task_get_prio(a, i);
+		a_min = prio < a_min ? prio : a_min;
+		a_max = prio > a_max ? prio : a_max;
+		prio = bpf_dag_task_get_prio(b, i);
+		b_min = prio < b_min ? prio : b_min;
+		b_max = prio > b_max ? prio : b_max;
+	}
+
+	/*
+	 * The nodes of the two DAG tasks neither interleave nor collide.
+	 */
+	assert(a_max < b_min || b_max < a_min);
+
+	bpf_dag_task_free(b);
+	bpf_dag_task_free(a);
+}
+
 static void test_sys_info(void)
 {
+	struct bpf_cpumask *mask;
 	s32 err, pid, cpu;
 	s64 prio;
 
@@ -441,30 +1097,407 @@ static void test_sys_info(void)
 	assert(pid == 1001);
 	assert(prio == 6);
 	bpf_printk("[DEBUG] cpu=%d, pid=%d, prio=%lld", cpu, pid, prio);
+
+	/*
+	 * Only CPU0 and CPU2
+	 */
+	mask = bpf_cpumask_create();
+	assert_ret(mask);
+	bpf_cpumask_set_cpu(0, mask);
+	bpf_cpumask_set_cpu(2, mask);
+	assert(bpf_sys_info_get_max_prio_and_cpu_in((const struct cpumask *)mask, &cpu, &pid, &prio) == 0);
+	assert(cpu == 0);
+	assert(pid == 1000);
+	assert(prio == 5);
+	bpf_cpumask_release(mask);
+
+	/*
+	 * The LLC and the node of CPU0 contain CPU0 at least.
+	 */
+	assert(bpf_sys_info_get_max_prio_and_cpu_llc(0, &cpu, &pid, &prio) == 0);
+	assert(prio >= 5);
+	assert(bpf_sys_info_get_max_prio_and_cpu_node(0, &cpu, &pid, &prio) == 0);
+	assert(prio >= 5);
+}
+
+static void test_sys_info_victims(void)
+{
+	struct bpf_sys_info_victim victims[3];
+	s32 pid, cpu;
+	s64 prio;
+
+	/*
+	 * +--------+--------+--------+--------+
+	 * |  CPU0  |  CPU1  |  CPU2  |  CPU3  |
+	 * +--------+--------+--------+--------+
+	 * |  1000  |  1001  |  1002  |  1003  |
+	 * +--------+--------+--------+--------+
+	 * |     5  |     6  |     3  |     8  |
+	 * +--------+--------+--------+--------+
+	 */
+	assert(bpf_sys_info_update_cpu_prio(0, 1000, 5) == 0);
+	assert(bpf_sys_info_update_cpu_prio(1, 1001, 6) == 0);
+	assert(bpf_sys_info_update_cpu_prio(2, 1002, 3) == 0);
+	assert(bpf_sys_info_update_cpu_prio(3, 1003, 8) == 0);
+
+	assert(bpf_sys_info_get_victims(victims, sizeof(victims), 0) == 3);
+	assert(victims[0].cpu == 3 && victims[0].prio == 8);
+	assert(victims[1].cpu == 1 && victims[1].prio == 6);
+	assert(victims[2].cpu == 0 && victims[2].pid == 1000);
+
+	/*
+	 * Reserve CPU3 and CPU1. The next waker gets CPU0.
+	 */
+	assert(bpf_sys_info_get_victims(victims, 2 * sizeof(victims[0]), BPF_SYS_INFO_RESERVE) == 2);
+	assert(victims[0].cpu == 3);
+	assert(victims[1].cpu == 1);
+	assert(bpf_sys_info_get_max_prio_and_cpu(&cpu, &pid, &prio) == 0);
+	assert(cpu == 0);
+
+	/*
+	 * Releasing CPU1 and updating CPU3 make them visible again.
+	 */
+	assert(bpf_sys_info_release_cpu(1) == 0);
+	assert(bpf_sys_info_update_cpu_prio(3, 1004, 1) == 0);
+	assert(bpf_sys_info_get_max_prio_and_cpu(&cpu, &pid, &prio) == 0);
+	assert(cpu == 1);
+}
+
+static void test_runtime_est(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct bpf_dag_runtime_est est, *published;
+	s32 tid = 1;
+	s64 runtime;
+
+	/*
+	 * The source node is init, which always exists, so it can be measured.
+	 * 1 -----> 1001
+	 */
+	dag_task = bpf_dag_task_alloc(tid, 1, 100000, 100000);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 2) == 1);
+	assert(bpf_dag_task_add_edge(dag_task, tid, 1001) >= 0);
+	assert(bpf_dag_task_node_start(dag_task, 0) < 0); // not committed yet
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	assert(bpf_dag_task_node_stop(dag_task, 0, 0) < 0); // not started yet
+	assert(bpf_dag_task_get_runtime_est(dag_task, 0, &est) == 0);
+	assert(est.nr_samples == 0);
+
+	bpf_dag_task_culc_HELT_prio(dag_task);
+
+	assert(bpf_dag_task_node_start(dag_task, 0) == 0);
+	runtime = bpf_dag_task_node_stop(dag_task, 0, BPF_DAG_EST_SET_WEIGHT_EWMA);
+	assert(runtime >= 0);
+	assert(bpf_dag_task_node_stop(dag_task, 0, 0) < 0); // already stopped
+
+	/*
+	 * The first sample initializes both estimates, and the EWMA is written
+	 * back into the weight.
+	 */
+	assert(bpf_dag_task_get_runtime_est(dag_task, 0, &est) == 0);
+	assert(est.nr_samples == 1);
+	assert(est.last == runtime && est.ewma == runtime && est.pctl == runtime);
+	assert(bpf_dag_task_get_weight(dag_task, 0) == runtime);
+
+	assert(publish_runtime_est(dag_task, tid) == 0);
+	published = bpf_map_lookup_elem(&est_ctx, &tid);
+	assert(published && published->nr_samples == 1);
+	bpf_map_delete_elem(&est_ctx, &tid);
+
+	bpf_dag_task_free(dag_task);
+}
+
+/*
+ * The number of the events reported to dag_sched_sample for the DAG task whose
+ * id is dag_sched_events_dag_id. The other DAG tasks alive in the system don't
+ * affect the counts, so the tests can check them exactly.
+ */
+struct dag_sched_events {
+	u64 job_release;
+	u64 node_ready;
+	u64 node_complete;
+	u64 deadline_miss;
+	u64 prio_recompute;
+};
+
+struct dag_sched_events dag_sched_events;
+s32 dag_sched_events_dag_id = -1;
+
+static void dag_sched_events_start(struct bpf_dag_task *dag_task)
+{
+	__builtin_memset(&dag_sched_events, 0, sizeof(dag_sched_events));
+	dag_sched_events_dag_id = dag_task->id;
+}
+
+static void dag_sched_events_stop(void)
+{
+	dag_sched_events_dag_id = -1;
+}
+
+#define count_dag_sched_event(dag_task, event)					\
+	do {									\
+		if ((dag_task)->id == dag_sched_events_dag_id)			\
+			__sync_fetch_and_add(&dag_sched_events.event, 1);	\
+	} while (0)
+
+static void test_node_complete(void)
+{
+	struct bpf_dag_task *dag_task;
+	u32 ready[4];
+	s64 job;
+
+	/*
+	 * 1000 -----> 1001 -----> 1003
+	 *   |                      ^
+	 *   +-------> 1002 --------+
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 100000, 100000);
+	assert_ret(dag_task);
+	dag_sched_events_start(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 1) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 1) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	bpf_dag_task_culc_HELT_prio(dag_task);
+
+	job = bpf_dag_task_job_release(dag_task);
+	assert_ret(job > 0);
+	assert(bpf_dag_task_job_get_pending(dag_task, job, 0) == 0);
+	assert(bpf_dag_task_job_get_pending(dag_task, job, 3) == 2);
+	assert(bpf_dag_task_node_complete(dag_task, job, 1, ready, sizeof(ready)) < 0); // not ready
+
+	assert(bpf_dag_task_node_complete(dag_task, job, 0, ready, sizeof(ready)) == 2);
+	assert(ready[0] == 1 && ready[1] == 2);
+	assert(bpf_dag_task_node_complete(dag_task, job, 0, ready, sizeof(ready)) < 0); // finished
+	assert(bpf_dag_task_job_get_pending(dag_task, job, 0) == -1);
+
+	assert(bpf_dag_task_node_complete(dag_task, job, 1, ready, sizeof(ready)) == 0);
+	assert(bpf_dag_task_job_get_pending(dag_task, job, 3) == 1);
+	assert(bpf_dag_task_node_complete(dag_task, job, 2, ready, sizeof(ready)) == 1);
+	assert(ready[0] == 3);
+	assert(bpf_dag_task_node_complete(dag_task, job, 3, ready, sizeof(ready)) == 0);
+
+	assert(dag_sched_events.node_complete == 4);
+	assert(dag_sched_events.node_ready == 4);
+
+	assert(bpf_dag_task_job_complete(dag_task, job) == 0);
+	assert(bpf_dag_task_node_complete(dag_task, job, 3, ready, sizeof(ready)) < 0); // not active
+
+	dag_sched_events_stop();
+	bpf_dag_task_free(dag_task);
+}
+
+static void test_ready_queue(void)
+{
+	struct bpf_dag_task *dag_task;
+	struct bpf_dag_rq_item item, peeked;
+	s32 cpu = bpf_get_smp_processor_id();
+	u32 dag_id;
+	s64 prev;
+	s64 job;
+
+	/*
+	 * 1000 -----> 1001 -----> 1003
+	 *   |                      ^
+	 *   +-------> 1002 --------+
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 100000, 100000);
+	assert_ret(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 3) == 1);
+	assert(bpf_dag_task_add_node(dag_task, 1002, 1) == 2);
+	assert(bpf_dag_task_add_node(dag_task, 1003, 1) == 3);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1002) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1001, 1003) >= 0);
+	assert(bpf_dag_task_add_edge(dag_task, 1002, 1003) >= 0);
+	assert(bpf_dag_rq_push(BPF_DAG_RQ_GLOBAL, dag_task, 0, 0) < 0); // not committed
+	assert(bpf_dag_task_commit(dag_task) == 0);
+	bpf_dag_task_culc_HELT_prio(dag_task);
+	dag_id = dag_task->id;
+
+	job = bpf_dag_task_job_release(dag_task);
+	assert_ret(job > 0);
+
+	/*
+	 * The ready queues are shared with the schedulers using dag_bpf.ko, and
+	 * a popped node of another DAG task couldn't be pushed back. So the
+	 * nodes are queued to the queue of this CPU, and only the nodes that
+	 * peek shows to be ours are popped.
+	 */
+	assert(bpf_dag_rq_push(-2, dag_task, job, 0) < 0); // invalid queue
+	assert(bpf_dag_rq_push(cpu, dag_task, job + 1, 0) < 0); // not active
+	assert(bpf_dag_rq_push(cpu, dag_task, job, 3) == 0);
+	assert(bpf_dag_rq_push(cpu, dag_task, job, 1) == 0);
+	assert(bpf_dag_rq_push(cpu, dag_task, job, 2) == 0);
+	assert(bpf_dag_rq_push(cpu, dag_task, job, 0) == 0);
+	assert(bpf_dag_rq_push(BPF_DAG_RQ_GLOBAL, dag_task, job, 0) < 0); // already queued
+
+	assert(bpf_dag_rq_remove(dag_task, 2) == 0);
+	assert(bpf_dag_rq_remove(dag_task, 2) < 0);
+
+	// the nodes of this DAG task come out in the order of their priorities
+	prev = -1;
+	for (int i = 0; i < 3; i++) {
+		if (bpf_dag_rq_peek_min(cpu, &peeked) || peeked.dag_id != dag_id)
+			break;
+		assert(bpf_dag_rq_pop_min(cpu, &item) == 0);
+		assert(item.dag_id == dag_id);
+		assert(item.prio == peeked.prio && item.node_id == peeked.node_id);
+		assert(item.cpu == cpu);
+		assert(item.job == job);
+		assert(item.node_id != 2);
+		assert(item.prio == bpf_dag_task_job_get_prio(dag_task, job, item.node_id));
+		assert(item.prio >= prev);
+		prev = item.prio;
+	}
+	// the nodes left behind a more urgent node of another DAG task
+	for (int i = 0; i < 4; i++)
+		bpf_dag_rq_remove(dag_task, i);
+	assert(bpf_dag_rq_remove(dag_task, 0) < 0);
+
+	// the global queue is only pushed to and removed from
+	assert(bpf_dag_rq_push(BPF_DAG_RQ_GLOBAL, dag_task, job, 1) == 0);
+	assert(bpf_dag_rq_remove(dag_task, 1) == 0);
+
+	/*
+	 * bpf_dag_rq_steal() pops from the queues of the other CPUs, so it
+	 * isn't called here.
+	 */
+
+	// freeing a DAG task takes its nodes out of the queues
+	assert(bpf_dag_rq_push(cpu, dag_task, 0, 1) == 0);
+	assert(bpf_dag_task_job_complete(dag_task, job) == 0);
+	bpf_dag_task_free(dag_task);
+	if (bpf_dag_rq_peek_min(cpu, &item) == 0)
+		assert(item.dag_id != dag_id);
+}
+
+static void test_dag_sched_ops(void)
+{
+	struct bpf_dag_task *dag_task;
+	s64 job;
+
+	/*
+	 * 1000(1) -----> 1001(2)
+	 * The relative deadline is 1 ns, so every job misses its deadline.
+	 */
+	dag_task = bpf_dag_task_alloc(1000, 1, 1, 100000);
+	assert_ret(dag_task);
+	dag_sched_events_start(dag_task);
+
+	assert(bpf_dag_task_add_node(dag_task, 1001, 2) == 1);
+	assert(bpf_dag_task_add_edge(dag_task, 1000, 1001) >= 0);
+	assert(bpf_dag_task_commit(dag_task) == 0);
+
+	bpf_dag_task_culc_HELT_prio(dag_task);
+	assert(dag_sched_events.prio_recompute == 1);
+
+	job = bpf_dag_task_job_release(dag_task);
+	assert(job > 0);
+	assert(dag_sched_events.job_release == 1);
+	assert(dag_sched_events.node_ready == 1); // only the source
+
+	assert(bpf_dag_task_job_complete(dag_task, job) == 0);
+	assert(dag_sched_events.deadline_miss == 1);
+
+	dag_sched_events_stop();
+	bpf_dag_task_free(dag_task);
 }
 
 SEC("struct_ops/my_ops_calculate")
 u64 BPF_PROG(my_ops_calculate, u64 n)
 {
 	struct bpf_dag_task *dag_task;
-	s32 err;
 	u8 buf[100];
 
+	nr_assert_failures = 0;
 	bpf_user_ringbuf_drain(&urb, user_ringbuf_callback, NULL, 0);
 
 	test_invalid_dag_task();
-	test_invalid_dag_task2();
+	test_large_dag_task();
 	test_invalid_dag_task3();
 
+	test_commit();
+	test_alloc_bulk();
 	test_culc_HELT_prio();
 	test_culc_HLBS_prio();
+	test_incremental_prio();
+	test_slack();
+	test_federated();
+	test_set_weights();
+	test_prio_encoding();
+	test_prio_same_unit();
+	test_jobs();
+	test_runtime_est();
+	test_dag_sched_ops();
+	test_node_complete();
+	test_ready_queue();
 
 	test_sys_info();
+	test_sys_info_victims();
 
-	return err;
+	return nr_assert_failures;
+}
+
+// Called by the module every urb_drain_latency_us, so that the messages are applied without reading my_ops/ctl.
+SEC("struct_ops/my_ops_drain")
+int BPF_PROG(my_ops_drain)
+{
+	return bpf_user_ringbuf_drain(&urb, user_ringbuf_callback, NULL, 0);
 }
 
 SEC(".struct_ops.link")
 struct my_ops my_ops_sample = {
 	.calculate = (void *) my_ops_calculate,
+	.drain = (void *) my_ops_drain,
+};
+
+SEC("struct_ops/dag_sched_job_release")
+void BPF_PROG(dag_sched_job_release, struct bpf_dag_task *dag_task, u64 job)
+{
+	count_dag_sched_event(dag_task, job_release);
+	emit_event(BPF_DAG_EVENT_JOB_RELEASE, dag_task->id, job, 0);
+}
+
+SEC("struct_ops/dag_sched_node_ready")
+void BPF_PROG(dag_sched_node_ready, struct bpf_dag_task *dag_task, u64 job, u32 node_id)
+{
+	count_dag_sched_event(dag_task, node_ready);
+}
+
+SEC("struct_ops/dag_sched_node_complete")
+void BPF_PROG(dag_sched_node_complete, struct bpf_dag_task *dag_task, u64 job, u32 node_id)
+{
+	count_dag_sched_event(dag_task, node_complete);
+}
+
+SEC("struct_ops/dag_sched_deadline_miss")
+void BPF_PROG(dag_sched_deadline_miss, struct bpf_dag_task *dag_task, u64 job, s64 lateness)
+{
+	count_dag_sched_event(dag_task, deadline_miss);
+	emit_event(BPF_DAG_EVENT_DEADLINE_MISS, dag_task->id, job, lateness);
+}
+
+SEC("struct_ops/dag_sched_prio_recompute")
+void BPF_PROG(dag_sched_prio_recompute, struct bpf_dag_task *dag_task, u32 nr_changed)
+{
+	count_dag_sched_event(dag_task, prio_recompute);
+	emit_event(BPF_DAG_EVENT_PRIO_RECOMPUTE, dag_task->id, nr_changed, 0);
+}
+
+SEC(".struct_ops.link")
+struct dag_sched_ops dag_sched_sample = {
+	.job_release	= (void *) dag_sched_job_release,
+	.node_ready	= (void *) dag_sched_node_ready,
+	.node_complete	= (void *) dag_sched_node_complete,
+	.deadline_miss	= (void *) dag_sched_deadline_miss,
+	.prio_recompute	= (void *) dag_sched_prio_recompute,
 };
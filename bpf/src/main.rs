@@ -3,6 +3,8 @@ mod bpf;
 use bpf::*;
 
 use libbpf_rs::skel::*;
+use libbpf_rs::AsRawLibbpf;
+use std::ffi::CString;
 use std::mem::MaybeUninit;
 
 use std::sync::Arc;
@@ -11,12 +13,24 @@ use std::sync::atomic::Ordering;
 
 use clap::{Parser, ValueEnum};
 
+use bpf_comm::map::BPF_MAP_PIN_DIR;
+use bpf_comm::ring_buffer::RingBuffer;
+use bpf_comm_api::dag_event::DagEvent;
+
 #[derive(Parser, Debug)]
 #[command(author, version, about)]
 struct Cli {
     /// Verifier log level
     #[arg(long, value_enum, default_value="none")]
     verifier_log_level: VerifierLogLevel,
+
+    /// Log the DAG tasks as text to the trace pipe (slow)
+    #[arg(long)]
+    verbose: bool,
+
+    /// Print the events written to the dag_events ring buffer
+    #[arg(long)]
+    events: bool,
 }
 
 #[derive(Copy, Clone, Debug, ValueEnum)]
@@ -45,7 +59,8 @@ fn main() {
         VerifierLogLevel::Info => 1,
         VerifierLogLevel::Verbose => 1 | 2,
     };
-    let open_skel = skel_builder.open_opts(open_opts, &mut open_object).unwrap();
+    let mut open_skel = skel_builder.open_opts(open_opts, &mut open_object).unwrap();
+    open_skel.maps.rodata_data.verbose = cli.verbose;
     let skel = open_skel.load();
 
     // The kernel log ends with "\0\0", so we look for a place
@@ -70,7 +85,12 @@ fn main() {
 	    skel.unwrap()
     };
 
+    if let Err(err) = pin_maps(&skel) {
+        println!("{err}: the maps are found by scanning instead");
+    }
+
     let _link = skel.maps.my_ops_sample.attach_struct_ops().unwrap();
+    let _dag_sched_link = skel.maps.dag_sched_sample.attach_struct_ops().unwrap();
     println!("Successfully attached bpf program!");
 
     // Register Ctrl+C handler that terminate this app
@@ -81,9 +101,40 @@ fn main() {
         shutdown_clone.store(true, Ordering::Relaxed);
     }).expect("Error setting Ctrl+C handler");
 
+    let mut events = if cli.events {
+        Some(RingBuffer::new("dag_events").unwrap())
+    } else {
+        None
+    };
+
     while !shutdown.load(Ordering::Relaxed) {
         let duration = std::time::Duration::from_millis(100);
-        std::thread::sleep(duration);
+        match events.as_mut() {
+            Some(events) => {
+                // An interrupted poll is retried by the loop.
+                let _ = events.poll_as(duration, |event: DagEvent| {
+                    println!("[{}] {:?}", event.ts, event.kind());
+                });
+            }
+            None => std::thread::sleep(duration),
+        }
     }
+    let _ = std::fs::remove_dir_all(BPF_MAP_PIN_DIR);
     println!("Shutdown..");
 }
+
+// Pins the maps (urb, dag_tasks, dag_acks, ...) under BPF_MAP_PIN_DIR by their names,
+// so that bpf_comm opens them by path instead of scanning all the maps in the system.
+fn pin_maps(skel: &ExampleSkel<'_>) -> Result<(), String> {
+    // Remove the pins left by a run which didn't shut down cleanly.
+    let _ = std::fs::remove_dir_all(BPF_MAP_PIN_DIR);
+
+    let dir = CString::new(BPF_MAP_PIN_DIR).unwrap();
+    let err = unsafe {
+        libbpf_sys::bpf_object__pin_maps(skel.object().as_libbpf_object().as_ptr(), dir.as_ptr())
+    };
+    if err < 0 {
+        return Err(format!("Failed to pin the maps under {BPF_MAP_PIN_DIR} (err={err})"));
+    }
+    Ok(())
+}
@@ -3,6 +3,25 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/bpf.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/hash.h>
+#include <linux/completion.h>
+#include <linux/idr.h>
+#include <linux/kthread.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/sched.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 #include "dag_bpf.h"
 #include "asm-generic/bug.h"
@@ -17,10 +36,80 @@ MODULE_VERSION("0.1");
 // MARK: my_ops
 struct my_ops {
 	int (*calculate)(int n);
+
+	/*
+	 * Drains urb and returns the number of messages drained, or a negative
+	 * error. Optional. The module calls it every urb_drain_latency_us.
+	 */
+	int (*drain)(void);
 };
 
 static struct my_ops gops;
 
+// MARK: urb drain
+/*
+ * The messages on urb are applied by my_ops.drain from urb_drain_work, so they
+ * don't wait for my_ops/ctl to be read. The latency is rounded up to a jiffy.
+ */
+static unsigned int urb_drain_latency_us = 1000;
+
+static struct delayed_work urb_drain_work;
+
+// Updated only by urb_drain_work
+static struct {
+	u64 runs;
+	u64 drained;
+	u32 depth; // the number of messages waiting on urb at the last drain
+	u32 max_depth;
+} urb_drain_stats;
+
+static void urb_drain_kick(void)
+{
+	if (READ_ONCE(gops.drain))
+		mod_delayed_work(system_wq, &urb_drain_work, 0);
+}
+
+static void urb_drain_fn(struct work_struct *work)
+{
+	int (*drain)(void) = READ_ONCE(gops.drain);
+	unsigned int latency_us;
+	int nr;
+
+	if (!drain)
+		return;
+
+	nr = drain();
+	if (nr >= 0) {
+		WRITE_ONCE(urb_drain_stats.runs, urb_drain_stats.runs + 1);
+		WRITE_ONCE(urb_drain_stats.drained, urb_drain_stats.drained + nr);
+		WRITE_ONCE(urb_drain_stats.depth, nr);
+		if (nr > urb_drain_stats.max_depth)
+			WRITE_ONCE(urb_drain_stats.max_depth, nr);
+	}
+
+	latency_us = READ_ONCE(urb_drain_latency_us);
+	if (latency_us)
+		schedule_delayed_work(&urb_drain_work, usecs_to_jiffies(latency_us));
+}
+
+static int urb_drain_latency_set(const char *val, const struct kernel_param *kp)
+{
+	int err;
+
+	err = param_set_uint(val, kp);
+	if (!err)
+		urb_drain_kick(); // restart with the new period
+	return err;
+}
+
+static const struct kernel_param_ops urb_drain_latency_ops = {
+	.set = urb_drain_latency_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(urb_drain_latency_us, &urb_drain_latency_ops, &urb_drain_latency_us, 0644);
+MODULE_PARM_DESC(urb_drain_latency_us, "The maximum latency (us) until a message on urb is applied (0: only on my_ops/ctl and my_ops/urb_drain)");
+
 static bool my_ops_is_valid_access(int off, int size,
 				   enum bpf_access_type type,
 				   const struct bpf_prog *prog,
@@ -74,6 +163,7 @@ static int bpf_my_ops_reg(void *kdata, struct bpf_link *link)
 	pr_info("st_ops->reg()\n");
 
 	gops = *(struct my_ops *) kdata;
+	urb_drain_kick();
 	return 0;
 }
 
@@ -81,6 +171,8 @@ static void bpf_my_ops_unreg(void *kdata, struct bpf_link *link)
 {
 	pr_info("st_ops->unreg()\n");
 	gops.calculate = NULL;
+	WRITE_ONCE(gops.drain, NULL);
+	cancel_delayed_work_sync(&urb_drain_work);
 }
 
 static int calculate_stub(int n)
@@ -88,8 +180,14 @@ static int calculate_stub(int n)
 	return n;
 }
 
+static int drain_stub(void)
+{
+	return 0;
+}
+
 static struct my_ops my_ops_stubs = {
 	.calculate = calculate_stub,
+	.drain = drain_stub,
 };
 
 static struct bpf_struct_ops bpf_my_ops = {
@@ -104,9 +202,203 @@ static struct bpf_struct_ops bpf_my_ops = {
 	.cfi_stubs	= &my_ops_stubs,
 };
 
+// MARK: dag_sched_ops
+/*
+ * Callbacks invoked by the module at the events of DAG tasks, so scheduling
+ * policies can be written in BPF. Every callback is optional. They are called
+ * from the kfuncs that cause the events, so they run non-sleepable, and they
+ * must not call the kfunc that triggered them.
+ *
+ * Only one dag_sched_ops can be attached at a time, and it can be replaced
+ * atomically by updating its link.
+ */
+struct dag_sched_ops {
+	/*
+	 * A job instance was released by bpf_dag_task_job_release().
+	 */
+	void (*job_release)(struct bpf_dag_task *dag_task, u64 job);
+
+	/*
+	 * All the predecessors of node @node_id finished in @job.
+	 */
+	void (*node_ready)(struct bpf_dag_task *dag_task, u64 job, u32 node_id);
+
+	/*
+	 * Node @node_id finished in @job.
+	 */
+	void (*node_complete)(struct bpf_dag_task *dag_task, u64 job, u32 node_id);
+
+	/*
+	 * @job completed @lateness ns after its deadline.
+	 */
+	void (*deadline_miss)(struct bpf_dag_task *dag_task, u64 job, s64 lateness);
+
+	/*
+	 * The priorities of @nr_changed nodes were (re)computed.
+	 */
+	void (*prio_recompute)(struct bpf_dag_task *dag_task, u32 nr_changed);
+};
+
+static struct dag_sched_ops __rcu *dag_sched;
+static DEFINE_MUTEX(dag_sched_mutex); // serializes reg, unreg and update
+
+#define dag_sched_call(op, args...)					\
+	do {								\
+		struct dag_sched_ops *__ops;				\
+									\
+		rcu_read_lock();					\
+		__ops = rcu_dereference(dag_sched);			\
+		if (__ops && __ops->op)					\
+			__ops->op(args);				\
+		rcu_read_unlock();					\
+	} while (0)
+
+static bool dag_sched_ops_is_valid_access(int off, int size,
+					  enum bpf_access_type type,
+					  const struct bpf_prog *prog,
+					  struct bpf_insn_access_aux *info)
+{
+	return bpf_tracing_btf_ctx_access(off, size, type, prog, info);
+}
+
+static struct bpf_verifier_ops dag_sched_ops_bpf_verifier_ops = {
+	.get_func_proto  = my_ops_get_func_proto,
+	.is_valid_access = dag_sched_ops_is_valid_access,
+};
+
+static int bpf_dag_sched_ops_init(struct btf *btf)
+{
+	return 0;
+}
+
+static int bpf_dag_sched_ops_init_member(const struct btf_type *t,
+					 const struct btf_member *member,
+					 void *kdata, const void *udata)
+{
+	return 0;
+}
+
+static int bpf_dag_sched_ops_check_member(const struct btf_type *t,
+					  const struct btf_member *member,
+					  const struct bpf_prog *prog)
+{
+	if (prog->sleepable)
+		return -EINVAL;
+	return 0;
+}
+
+static int bpf_dag_sched_ops_reg(void *kdata, struct bpf_link *link)
+{
+	int err = 0;
+
+	mutex_lock(&dag_sched_mutex);
+	if (rcu_access_pointer(dag_sched))
+		err = -EEXIST;
+	else
+		rcu_assign_pointer(dag_sched, kdata);
+	mutex_unlock(&dag_sched_mutex);
+
+	if (!err)
+		pr_info("dag_sched_ops attached\n");
+	return err;
+}
+
+static void bpf_dag_sched_ops_unreg(void *kdata, struct bpf_link *link)
+{
+	mutex_lock(&dag_sched_mutex);
+	if (rcu_access_pointer(dag_sched) != kdata) {
+		mutex_unlock(&dag_sched_mutex);
+		return;
+	}
+	RCU_INIT_POINTER(dag_sched, NULL);
+	mutex_unlock(&dag_sched_mutex);
+
+	/*
+	 * Wait for the callbacks in flight before the programs are released.
+	 */
+	synchronize_rcu();
+	pr_info("dag_sched_ops detached\n");
+}
+
+static int bpf_dag_sched_ops_update(void *kdata, void *old_kdata, struct bpf_link *link)
+{
+	mutex_lock(&dag_sched_mutex);
+	if (rcu_access_pointer(dag_sched) != old_kdata) {
+		mutex_unlock(&dag_sched_mutex);
+		return -ENOENT;
+	}
+	rcu_assign_pointer(dag_sched, kdata);
+	mutex_unlock(&dag_sched_mutex);
+
+	synchronize_rcu();
+	pr_info("dag_sched_ops replaced\n");
+	return 0;
+}
+
+static int bpf_dag_sched_ops_validate(void *kdata)
+{
+	return 0;
+}
+
+static void job_release_stub(struct bpf_dag_task *dag_task, u64 job) {}
+static void node_ready_stub(struct bpf_dag_task *dag_task, u64 job, u32 node_id) {}
+static void node_complete_stub(struct bpf_dag_task *dag_task, u64 job, u32 node_id) {}
+static void deadline_miss_stub(struct bpf_dag_task *dag_task, u64 job, s64 lateness) {}
+static void prio_recompute_stub(struct bpf_dag_task *dag_task, u32 nr_changed) {}
+
+static struct dag_sched_ops dag_sched_ops_stubs = {
+	.job_release	= job_release_stub,
+	.node_ready	= node_ready_stub,
+	.node_complete	= node_complete_stub,
+	.deadline_miss	= deadline_miss_stub,
+	.prio_recompute	= prio_recompute_stub,
+};
+
+static struct bpf_struct_ops bpf_dag_sched_ops = {
+	.verifier_ops	= &dag_sched_ops_bpf_verifier_ops,
+	.init		= bpf_dag_sched_ops_init,
+	.init_member	= bpf_dag_sched_ops_init_member,
+	.check_member	= bpf_dag_sched_ops_check_member,
+	.reg		= bpf_dag_sched_ops_reg,
+	.unreg		= bpf_dag_sched_ops_unreg,
+	.update		= bpf_dag_sched_ops_update,
+	.validate	= bpf_dag_sched_ops_validate,
+	.name		= "dag_sched_ops",
+	.owner		= THIS_MODULE,
+	.cfi_stubs	= &dag_sched_ops_stubs,
+};
+
 // MARK: bpf_dag_task
 // The maximum of the number of DAG tasks.
-#define BPF_DAG_TASK_LIMIT 10
+// This can be changed at runtime via /sys/module/dag_bpf/parameters/max_dag_tasks.
+// Values beyond DAG_TASK_MAX_IDS have no effect, since the ids must fit in a priority key.
+static unsigned int max_dag_tasks = 1024;
+module_param(max_dag_tasks, uint, 0644);
+MODULE_PARM_DESC(max_dag_tasks, "The maximum number of DAG tasks that can be allocated at the same time");
+
+// Text tracing of the DAG task kfuncs (bpf_dag_task_dump() and the per-call
+// logs) is off by default, since formatting it costs more than the kfuncs.
+// Enable it via /sys/module/dag_bpf/parameters/verbose.
+static bool verbose;
+module_param(verbose, bool, 0644);
+MODULE_PARM_DESC(verbose, "Log the DAG task kfuncs and dumps to the kernel log");
+
+#define dag_verbose(fmt, ...)					\
+	do {							\
+		if (READ_ONCE(verbose))				\
+			pr_info(fmt, ##__VA_ARGS__);		\
+	} while (0)
+
+/*
+ * Consistency checks that walk every DAG task are only evaluated in a debug
+ * build (make DEBUG=1). Otherwise the condition is still type-checked but
+ * compiled out.
+ */
+#ifdef DAG_BPF_DEBUG
+#define DAG_BPF_DEBUG_CHECK(cond)	WARN_ON_ONCE(!(cond))
+#else
+#define DAG_BPF_DEBUG_CHECK(cond)	do { if (0) WARN_ON_ONCE(!(cond)); } while (0)
+#endif
 
 // Returns true if val is in the range [low, high).
 // Returns false otherwise.
@@ -122,101 +414,208 @@ static bool is_in_range_eq(s32 val, s32 low, s32 high)
 	return (low <= high) && (low <= val && val <= high);
 }
 
-static u32 cnt_nr_nodes(struct bpf_dag_task *dag_task, s32 tid)
+// MARK: dag_hash
+/*
+ * A minimal open-addressing hash table with linear probing.
+ * Entries are never removed, and a bucket whose key is DAG_HASH_EMPTY is empty.
+ * The table is kept at most half full, so lookups and inserts take O(1)
+ * on average.
+ */
+#define DAG_HASH_EMPTY		U64_MAX
+#define DAG_HASH_MIN_BUCKETS	16
+
+static u32 dag_hash_bucket(struct dag_hash *hash, u64 key)
+{
+	return hash_64(key, ilog2(hash->nr_buckets));
+}
+
+static s32 dag_hash_find(struct dag_hash *hash, u64 key)
 {
-	u32 cnt = 0;
+	u32 mask = hash->nr_buckets - 1;
 
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		if (dag_task->nodes[i].tid == tid)
-			cnt++;
+	if (!hash->nr_buckets)
+		return -1;
+
+	for (u32 i = dag_hash_bucket(hash, key);; i = (i + 1) & mask) {
+		struct dag_hash_entry *entry = &hash->buckets[i];
+
+		if (entry->key == key)
+			return entry->val;
+		if (entry->key == DAG_HASH_EMPTY)
+			return -1;
 	}
-	return cnt;
 }
 
-static u32 cnt_nr_edges(struct bpf_dag_task *dag_task, u32 from, s32 to)
+static void __dag_hash_insert(struct dag_hash *hash, u64 key, u32 val)
 {
-	u32 cnt = 0;
+	u32 mask = hash->nr_buckets - 1;
+	u32 i = dag_hash_bucket(hash, key);
 
-	for (int i = 0; i < dag_task->nr_edges; i++) {
-		if (dag_task->edges[i].from == from &&
-		    dag_task->edges[i].to == to)
-			cnt++;
-	}
-	return cnt;
+	while (hash->buckets[i].key != DAG_HASH_EMPTY)
+		i = (i + 1) & mask;
+
+	hash->buckets[i].key = key;
+	hash->buckets[i].val = val;
+	hash->nr_entries++;
 }
 
-// Returns true if a duplicate is found.
-static bool check_duplication_ins_outs(u32 *buf, u32 nr_elems)
+/*
+ * Makes room for @nr_entries entries in total.
+ * Returns 0 on success, otherwise a negative errno.
+ */
+static s32 dag_hash_reserve(struct dag_hash *hash, u32 nr_entries)
 {
-	bool visited[DAG_TASK_MAX_NODES];
+	struct dag_hash old = *hash;
+	struct dag_hash_entry *buckets;
+	u32 nr_buckets;
 
-	WARN_ON_ONCE(nr_elems > DAG_TASK_MAX_NODES);
+	if (2 * nr_entries <= hash->nr_buckets)
+		return 0;
 
-	for (int i = 0; i < DAG_TASK_MAX_NODES; i++) {
-		visited[i] = false;
-	}
+	nr_buckets = roundup_pow_of_two(max_t(u32, 2 * nr_entries, DAG_HASH_MIN_BUCKETS));
+	nr_buckets = max_t(u32, nr_buckets, 2 * hash->nr_buckets);
+	buckets = kmalloc_array(nr_buckets, sizeof(*buckets), GFP_ATOMIC | __GFP_NOWARN);
+	if (!buckets)
+		return -ENOMEM;
 
-	for (int i = 0; i < nr_elems; i++) {
-		if (visited[buf[i]])
-			return true;
-		visited[buf[i]] = true;
+	/*
+	 * Fills every key with DAG_HASH_EMPTY (all one bits).
+	 */
+	memset(buckets, 0xff, nr_buckets * sizeof(*buckets));
+
+	hash->nr_entries = 0;
+	hash->nr_buckets = nr_buckets;
+	hash->buckets = buckets;
+	for (u32 i = 0; i < old.nr_buckets; i++) {
+		if (old.buckets[i].key != DAG_HASH_EMPTY)
+			__dag_hash_insert(hash, old.buckets[i].key, old.buckets[i].val);
 	}
+	kfree(old.buckets);
 
-	return false;
+	return 0;
+}
+
+/*
+ * Inserts (@key, @val). @key must not be in @hash.
+ * Returns 0 on success, otherwise a negative errno.
+ */
+static s32 dag_hash_insert(struct dag_hash *hash, u64 key, u32 val)
+{
+	s32 err;
+
+	WARN_ON_ONCE(key == DAG_HASH_EMPTY);
+
+	err = dag_hash_reserve(hash, hash->nr_entries + 1);
+	if (err)
+		return err;
+
+	__dag_hash_insert(hash, key, val);
+	return 0;
+}
+
+static void dag_hash_destroy(struct dag_hash *hash)
+{
+	kfree(hash->buckets);
+	hash->buckets = NULL;
+	hash->nr_buckets = 0;
+	hash->nr_entries = 0;
+}
+
+static u64 edge_key(u32 from, u32 to)
+{
+	return ((u64)from << 32) | to;
+}
+
+/*
+ * If there is no node whose tid is @tid, then return -1.
+ * If the node is found, return the node id.
+ */
+static s32 get_node_id(struct bpf_dag_task *dag_task, s32 tid)
+{
+	return dag_hash_find(&dag_task->tid_index, (u32)tid);
+}
+
+/*
+ * If there is no edge (@from -> @to), then return -1.
+ * If the edge is found, return the edge id.
+ */
+static s32 get_edge_id(struct bpf_dag_task *dag_task, u32 from, u32 to)
+{
+	return dag_hash_find(&dag_task->edge_index, edge_key(from, to));
 }
 
 // debug function
 static bool bpf_dag_task_is_well_formed(struct bpf_dag_task *dag_task)
 {
-	if (!is_in_range(dag_task->id, 0, BPF_DAG_TASK_LIMIT))
+	if (!is_in_range_eq(dag_task->nr_nodes, 0, dag_task->max_nr_nodes))
 		return false;
 
-	if (!is_in_range_eq(dag_task->nr_nodes, 0, DAG_TASK_MAX_NODES))
+	if (!dag_task->frozen && !is_in_range_eq(dag_task->nr_edges, 0, dag_task->max_nr_edges))
 		return false;
 
-	if (!is_in_range_eq(dag_task->nr_edges, 0, DAG_TASK_MAX_EDGES))
+	if (dag_task->frozen && !dag_task->csr_valid)
 		return false;
 
+	u32 sum_nr_ins = 0, sum_nr_outs = 0;
 	for (int i = 0; i < dag_task->nr_nodes; i++) {
 		struct node_info *node = &dag_task->nodes[i];
 
-		if (!is_in_range_eq(node->nr_ins, 0, DAG_TASK_MAX_DEG))
-			return false;
-		
-		if (!is_in_range_eq(node->nr_outs, 0, DAG_TASK_MAX_DEG))
-			return false;
-
-		if (cnt_nr_nodes(dag_task, node->tid) != 1) {
+		if (get_node_id(dag_task, node->tid) != i) {
 			pr_err("DAG task has two or more node that share the same tid (=%d)", node->tid);
 			return false;
 		}
 
-		if (check_duplication_ins_outs(node->ins, node->nr_ins)) {
-			pr_err("node->ins has a duplicate");
+		if (node->nr_ins >= dag_task->nr_nodes || node->nr_outs >= dag_task->nr_nodes) {
+			pr_err("The degree of node%d (ins=%u, outs=%u) is too large", i, node->nr_ins, node->nr_outs);
 			return false;
 		}
 
-		if (check_duplication_ins_outs(node->outs, node->nr_outs)) {
-			pr_err("node->outs has a duplicate");
-			return false;
-		}
+		sum_nr_ins += node->nr_ins;
+		sum_nr_outs += node->nr_outs;
+	}
+
+	if (dag_task->tid_index.nr_entries != dag_task->nr_nodes ||
+	    (!dag_task->frozen && dag_task->edge_index.nr_entries != dag_task->nr_edges)) {
+		pr_err("The indexes of DAG task (%d) are inconsistent", dag_task->id);
+		return false;
+	}
 
-		for (int j = 0; j < node->nr_ins; j++) {
-			if (!is_in_range(node->ins[j], 0, dag_task->nr_nodes)) {
-				pr_err("node->ins[%d](=%d) is out of range.", j, node->ins[j]);
+	if (sum_nr_ins != dag_task->nr_edges || sum_nr_outs != dag_task->nr_edges) {
+		pr_err("The degrees of nodes don't match nr_edges (ins=%u, outs=%u, edges=%u)",
+			sum_nr_ins, sum_nr_outs, dag_task->nr_edges);
+		return false;
+	}
+
+	if (dag_task->csr_valid) {
+		for (int i = 0; i < dag_task->nr_nodes; i++) {
+			struct node_info *node = &dag_task->nodes[i];
+
+			if (dag_task->out_offs[i + 1] - dag_task->out_offs[i] != node->nr_outs ||
+			    dag_task->in_offs[i + 1] - dag_task->in_offs[i] != node->nr_ins) {
+				pr_err("CSR adjacency of node%d is inconsistent with its degree", i);
 				return false;
 			}
-		}
 
-		for (int j = 0; j < node->nr_outs; j++) {
-			if (!is_in_range(node->outs[j], 0, dag_task->nr_nodes)) {
-				pr_err("node->outs[%d](=%d) is out of range.", j, node->outs[j]);
-				return false;
+			for (u32 j = dag_task->out_offs[i]; j < dag_task->out_offs[i + 1]; j++) {
+				if (!is_in_range(dag_task->outs[j], i + 1, dag_task->nr_nodes)) {
+					pr_err("outs[%d](=%d) of node%d is out of range.", j, dag_task->outs[j], i);
+					return false;
+				}
+			}
+
+			for (u32 j = dag_task->in_offs[i]; j < dag_task->in_offs[i + 1]; j++) {
+				if (!is_in_range(dag_task->ins[j], 0, i)) {
+					pr_err("ins[%d](=%d) of node%d is out of range.", j, dag_task->ins[j], i);
+					return false;
+				}
 			}
 		}
 	}
 
-	for (int i = 0; i < dag_task->nr_edges; i++) {
+	/*
+	 * The edge list has been folded into the CSR adjacency after commit.
+	 */
+	for (int i = 0; !dag_task->frozen && i < dag_task->nr_edges; i++) {
 		struct edge_info *edge = &dag_task->edges[i];
 
 		if (!is_in_range(edge->from, 0, dag_task->nr_nodes))
@@ -225,7 +624,7 @@ static bool bpf_dag_task_is_well_formed(struct bpf_dag_task *dag_task)
 		if (!is_in_range(edge->to, 0, dag_task->nr_nodes))
 			return false;
 
-		if (cnt_nr_edges(dag_task, edge->from, edge->to) != 1) {
+		if (get_edge_id(dag_task, edge->from, edge->to) != i) {
 			pr_err("DAG task has a duplicate edge (%d -> %d)", edge->from , edge->to);
 			return false;
 		}
@@ -250,553 +649,3200 @@ static bool bpf_dag_task_is_well_formed(struct bpf_dag_task *dag_task)
 }
 
 /*
- * Data structure for managing all DAG tasks.
+ * Returns true if every node is reachable from the source node (node 0).
  *
- * TODO: Protect with mutual exclusion
+ * Every edge goes from a smaller node id to a larger one, so by induction on
+ * the node id, it is enough that the source has no predecessors and every
+ * other node has at least one.
  */
-struct bpf_dag_task_manager {
-	u32			nr_dag_tasks;
-	bool			inuse[BPF_DAG_TASK_LIMIT];
-	struct bpf_dag_task	dag_tasks[BPF_DAG_TASK_LIMIT];
-};
-
-static struct bpf_dag_task_manager bpf_dag_task_manager;
-
-static bool bpf_dag_task_manager_is_well_formed(void)
+static bool bpf_dag_task_is_connected(struct bpf_dag_task *dag_task)
 {
-	u32 inuse_cnt;
+	if (dag_task->nr_nodes == 0)
+		return false;
 
-	if (!(0 <= bpf_dag_task_manager.nr_dag_tasks &&
-	      bpf_dag_task_manager.nr_dag_tasks <= BPF_DAG_TASK_LIMIT)) {
+	if (dag_task->nodes[0].nr_ins != 0) {
+		pr_err("The source node of DAG task (%d) has a predecessor", dag_task->id);
 		return false;
 	}
 
-	inuse_cnt = 0;
-	for (int i = 0; i < BPF_DAG_TASK_LIMIT; i++) {
-		if (bpf_dag_task_manager.inuse[i]) {
-			inuse_cnt++;
-			if (!bpf_dag_task_is_well_formed(&bpf_dag_task_manager.dag_tasks[i]))
-				return false;
+	for (int i = 1; i < dag_task->nr_nodes; i++) {
+		if (dag_task->nodes[i].nr_ins == 0) {
+			pr_err("node%d (tid=%d) of DAG task (%d) isn't reachable from the source node",
+				i, dag_task->nodes[i].tid, dag_task->id);
+			return false;
 		}
 	}
 
-	return bpf_dag_task_manager.nr_dag_tasks == inuse_cnt;
+	return true;
 }
 
-static __init void bpf_dag_task_manager_init(void)
-{
-	pr_info("[*] bpf_dag_task_manager_init");
-	bpf_dag_task_manager.nr_dag_tasks = 0;
-	for (int i = 0; i < BPF_DAG_TASK_LIMIT; i++) {
-		bpf_dag_task_manager.inuse[i] = false;
-		bpf_dag_task_manager.dag_tasks[i].id = i;
-	}
+// MARK: dag_rq
+/*
+ * Ready queues of DAG nodes ordered by their priority keys. There is a global
+ * ready queue and one per possible CPU. Each queue is a cached rbtree, so the
+ * most urgent node (the smallest key) is read in O(1) and a push or a removal
+ * takes O(log n).
+ *
+ * The entries are embedded in the committed DAG tasks, so queueing doesn't
+ * allocate, and a node can be removed without searching for it. entry->rq is
+ * only written with the lock of the queue it points to held, and an entry is
+ * taken out of every queue before its DAG task is released.
+ */
+struct dag_rq {
+	raw_spinlock_t lock;
+	struct rb_root_cached root;
+	s64 min_prio; // the key of the leftmost entry, S64_MAX if empty
+} ____cacheline_aligned_in_smp;
 
-	WARN_ON_ONCE(!bpf_dag_task_manager_is_well_formed()); // TODO: check only when debug mode
-}
+/*
+ * The number of times bpf_dag_rq_steal() retries a domain when the queue it
+ * chose was drained before it got the lock.
+ */
+#define DAG_RQ_STEAL_RETRIES	3
 
-// MARK: bpf_dag_task API
-static s32 __bpf_dag_task_add_node(struct bpf_dag_task *dag_task, u32 tid, s64 weight)
+static struct dag_rq dag_rq_global;
+static struct dag_rq __percpu *dag_rq_cpus;
+
+static void dag_rq_init(struct dag_rq *rq)
 {
-	s32 node_id;
+	raw_spin_lock_init(&rq->lock);
+	rq->root = RB_ROOT_CACHED;
+	rq->min_prio = S64_MAX;
+}
 
-	if (dag_task->nr_nodes == DAG_TASK_MAX_NODES) {
-		pr_warn("bpf_dag_task_add_node: The maximum number of DAG nodes (%d) has been reached.", DAG_TASK_MAX_NODES);
-		return -1;
-	}
+static __init int bpf_dag_rq_init(void)
+{
+	int cpu;
 
-	if (cnt_nr_nodes(dag_task, tid) > 0) {
-		pr_warn("bpf_dag_task_add_node: The node (tid=%d) already exists.", tid);
-		return -1;
-	}
+	dag_rq_cpus = alloc_percpu(struct dag_rq);
+	if (!dag_rq_cpus)
+		return -ENOMEM;
 
-	node_id = dag_task->nr_nodes;
-	dag_task->nr_nodes++;
-	dag_task->nodes[node_id].tid = tid;
-	dag_task->nodes[node_id].weight = weight;
-	dag_task->nodes[node_id].nr_ins = 0;
-	dag_task->nodes[node_id].nr_outs = 0;
+	dag_rq_init(&dag_rq_global);
+	for_each_possible_cpu(cpu)
+		dag_rq_init(per_cpu_ptr(dag_rq_cpus, cpu));
 
-	WARN_ON_ONCE(!bpf_dag_task_manager_is_well_formed()); // TODO: check only when debug mode
+	return 0;
+}
 
-	return node_id;
+static void bpf_dag_rq_exit(void)
+{
+	free_percpu(dag_rq_cpus);
 }
 
 /*
- * If there is no node whose tid is @tid, then return -1.
- * If the node is found, return the node id.
+ * Returns the ready queue selected by @cpu, or NULL if @cpu is invalid.
  */
-static s32 get_node_id(struct bpf_dag_task *dag_task, s32 tid)
+static struct dag_rq *dag_rq_of(s32 cpu)
 {
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		if (dag_task->nodes[i].tid == tid)
-			return i;
-	}
+	if (cpu == BPF_DAG_RQ_GLOBAL)
+		return &dag_rq_global;
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return NULL;
+	return per_cpu_ptr(dag_rq_cpus, cpu);
+}
 
-	return -1;
+/*
+ * Entries are ordered by (prio, dag_id, node_id), so the order is total and
+ * doesn't depend on the order of the pushes.
+ */
+static bool dag_rq_entry_less(struct rb_node *a, const struct rb_node *b)
+{
+	const struct dag_rq_entry *u = rb_entry(a, struct dag_rq_entry, rb_node);
+	const struct dag_rq_entry *v = rb_entry(b, struct dag_rq_entry, rb_node);
+
+	if (u->prio != v->prio)
+		return u->prio < v->prio;
+	if (u->dag_id != v->dag_id)
+		return u->dag_id < v->dag_id;
+	return u->node_id < v->node_id;
 }
 
-static s32 __bpf_dag_task_add_edge(struct bpf_dag_task *dag_task, u32 from_tid, u32 to_tid)
+static struct dag_rq_entry *dag_rq_first(struct dag_rq *rq)
 {
-	s32 edge_id, from, to;
+	return rb_entry_safe(rb_first_cached(&rq->root), struct dag_rq_entry, rb_node);
+}
 
-	from = get_node_id(dag_task, from_tid);
-	to = get_node_id(dag_task, to_tid);
+/*
+ * Updates min_prio of @rq. Called with the lock of @rq held.
+ */
+static void dag_rq_update_min(struct dag_rq *rq)
+{
+	struct dag_rq_entry *first = dag_rq_first(rq);
 
-	if (from < 0 || to < 0) {
-		pr_err("There isn't a corresponding node (from_tid=%d, to_tid=%d)", from_tid, to_tid);
-		return -1;
-	}
+	WRITE_ONCE(rq->min_prio, first ? first->prio : S64_MAX);
+}
 
-	// from and to are valid!
-	WARN_ON_ONCE(!(0 <= from && from < dag_task->nr_nodes));
-	WARN_ON_ONCE(!(0 <= to && to < dag_task->nr_nodes));
+/*
+ * Queues @entry with @prio and @job to @rq.
+ * Returns 0 on success, or -EBUSY if @entry is already in a ready queue.
+ */
+static s32 dag_rq_push(struct dag_rq *rq, struct dag_rq_entry *entry, s64 prio, u64 job)
+{
+	unsigned long flags;
 
-	if (dag_task->nr_edges == DAG_TASK_MAX_EDGES) {
-		pr_warn("The maximum number of DAG edges (%d) has been reached.", DAG_TASK_MAX_EDGES);
-		return -1;
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	if (cmpxchg(&entry->rq, NULL, rq) != NULL) {
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+		return -EBUSY;
 	}
+	entry->prio = prio;
+	entry->job = job;
+	rb_add_cached(&entry->rb_node, &rq->root, dag_rq_entry_less);
+	dag_rq_update_min(rq);
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
 
-	if (cnt_nr_edges(dag_task, from, to) > 0) {
-		pr_warn("Edge (%d -> %d) already exists in DAG task (%d)",
-			from, to, dag_task->id);
-		return -1;
-	}
+	return 0;
+}
+
+static void dag_rq_entry_to_item(struct dag_rq_entry *entry, s32 cpu,
+				 struct bpf_dag_rq_item *item)
+{
+	item->dag_id = entry->dag_id;
+	item->node_id = entry->node_id;
+	item->job = entry->job;
+	item->tid = entry->tid;
+	item->cpu = cpu;
+	item->prio = entry->prio;
+}
+
+/*
+ * Takes @entry out of @rq. Called with the lock of @rq held.
+ */
+static void dag_rq_erase(struct dag_rq *rq, struct dag_rq_entry *entry)
+{
+	rb_erase_cached(&entry->rb_node, &rq->root);
+	RB_CLEAR_NODE(&entry->rb_node);
+	dag_rq_update_min(rq);
+	WRITE_ONCE(entry->rq, NULL);
+}
+
+/*
+ * Takes @entry out of the ready queue holding it.
+ * Returns 0 on success, or -ENOENT if @entry isn't in any ready queue.
+ */
+static s32 dag_rq_remove(struct dag_rq_entry *entry)
+{
+	unsigned long flags;
+	struct dag_rq *rq;
+
+	for (;;) {
+		rq = READ_ONCE(entry->rq);
+		if (!rq)
+			return -ENOENT;
+
+		raw_spin_lock_irqsave(&rq->lock, flags);
+		if (entry->rq == rq)
+			break;
+		// popped or moved by another CPU in the meantime
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+	}
+	dag_rq_erase(rq, entry);
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return 0;
+}
+
+/*
+ * Takes the most urgent entry out of @rq, or peeks it if @pop is false.
+ * Returns 0 on success, or -ENOENT if @rq is empty.
+ */
+static s32 dag_rq_first_item(struct dag_rq *rq, s32 cpu, struct bpf_dag_rq_item *item, bool pop)
+{
+	struct dag_rq_entry *first;
+	unsigned long flags;
+	s32 ret = -ENOENT;
+
+	if (READ_ONCE(rq->min_prio) == S64_MAX)
+		return -ENOENT;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	first = dag_rq_first(rq);
+	if (first) {
+		// copy it before another CPU can push it again
+		dag_rq_entry_to_item(first, cpu, item);
+		if (pop)
+			dag_rq_erase(rq, first);
+		ret = 0;
+	}
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return ret;
+}
+
+/*
+ * Takes every node of @dag_task out of the ready queues.
+ */
+static void dag_rq_remove_all(struct bpf_dag_task *dag_task)
+{
+	for (int i = 0; i < dag_task->nr_nodes; i++)
+		dag_rq_remove(&dag_task->rq_entries[i]);
+}
+
+/*
+ * Data structure for managing all DAG tasks.
+ *
+ * DAG tasks are allocated from a dedicated kmem_cache, so the memory usage
+ * follows the number of live DAG tasks. Each DAG task gets its id from @idr,
+ * which also maps the id back to the DAG task.
+ */
+struct bpf_dag_task_manager {
+	spinlock_t		lock; /* protects @nr_dag_tasks and @idr */
+	u32			nr_dag_tasks;
+	struct idr		idr;
+	struct kmem_cache	*cachep;
+};
+
+static struct bpf_dag_task_manager bpf_dag_task_manager;
+
+/*
+ * The initial capacity of a DAG task. The storage grows geometrically
+ * up to DAG_TASK_MAX_NODES / DAG_TASK_MAX_EDGES as nodes and edges are added.
+ */
+#define DAG_TASK_INIT_NODES	8
+#define DAG_TASK_INIT_EDGES	16
+
+/*
+ * Grows the storage of @dag_task so that it can hold at least @nr_nodes nodes.
+ * Returns 0 on success, otherwise a negative errno.
+ */
+static s32 bpf_dag_task_reserve_nodes(struct bpf_dag_task *dag_task, u32 nr_nodes)
+{
+	struct node_info *nodes;
+	s64 *prio, *weight, *rank, *earliest_start, *latest_start;
+	u32 *order, *pos, *buf;
+	unsigned long *queued;
+	u32 cap;
+
+	if (nr_nodes <= dag_task->max_nr_nodes)
+		return 0;
+
+	if (WARN_ON_ONCE(dag_task->frozen))
+		return -EPERM;
+
+	if (nr_nodes > DAG_TASK_MAX_NODES)
+		return -E2BIG;
+
+	cap = max_t(u32, dag_task->max_nr_nodes * 2, DAG_TASK_INIT_NODES);
+	cap = clamp_t(u32, cap, nr_nodes, DAG_TASK_MAX_NODES);
+
+	nodes = krealloc_array(dag_task->nodes, cap, sizeof(*nodes), GFP_ATOMIC | __GFP_NOWARN);
+	if (!nodes)
+		return -ENOMEM;
+	dag_task->nodes = nodes;
+
+	prio = krealloc_array(dag_task->prio, cap, sizeof(*prio), GFP_ATOMIC | __GFP_NOWARN);
+	if (!prio)
+		return -ENOMEM;
+	dag_task->prio = prio;
+
+	weight = krealloc_array(dag_task->weight, cap, sizeof(*weight), GFP_ATOMIC | __GFP_NOWARN);
+	if (!weight)
+		return -ENOMEM;
+	dag_task->weight = weight;
+
+	rank = krealloc_array(dag_task->rank, cap, sizeof(*rank), GFP_ATOMIC | __GFP_NOWARN);
+	if (!rank)
+		return -ENOMEM;
+	dag_task->rank = rank;
+
+	order = krealloc_array(dag_task->order, cap, sizeof(*order), GFP_ATOMIC | __GFP_NOWARN);
+	if (!order)
+		return -ENOMEM;
+	dag_task->order = order;
+
+	pos = krealloc_array(dag_task->pos, cap, sizeof(*pos), GFP_ATOMIC | __GFP_NOWARN);
+	if (!pos)
+		return -ENOMEM;
+	dag_task->pos = pos;
+
+	earliest_start = krealloc_array(dag_task->earliest_start, cap, sizeof(*earliest_start),
+					GFP_ATOMIC | __GFP_NOWARN);
+	if (!earliest_start)
+		return -ENOMEM;
+	dag_task->earliest_start = earliest_start;
+
+	latest_start = krealloc_array(dag_task->latest_start, cap, sizeof(*latest_start),
+				      GFP_ATOMIC | __GFP_NOWARN);
+	if (!latest_start)
+		return -ENOMEM;
+	dag_task->latest_start = latest_start;
+
+	buf = krealloc_array(dag_task->buf, cap, sizeof(*buf), GFP_ATOMIC | __GFP_NOWARN);
+	if (!buf)
+		return -ENOMEM;
+	dag_task->buf = buf;
+
+	/*
+	 * queued must start out all zero, and krealloc() only zeroes the grown
+	 * part if every allocation of it passes __GFP_ZERO.
+	 */
+	queued = krealloc_array(dag_task->queued, BITS_TO_LONGS(cap), sizeof(*queued),
+				GFP_ATOMIC | __GFP_NOWARN | __GFP_ZERO);
+	if (!queued)
+		return -ENOMEM;
+	dag_task->queued = queued;
+
+	if (dag_hash_reserve(&dag_task->tid_index, cap))
+		return -ENOMEM;
+
+	dag_task->max_nr_nodes = cap;
+	return 0;
+}
+
+/*
+ * Grows the storage of @dag_task so that it can hold at least @nr_edges edges.
+ * Returns 0 on success, otherwise a negative errno.
+ */
+static s32 bpf_dag_task_reserve_edges(struct bpf_dag_task *dag_task, u32 nr_edges)
+{
+	struct edge_info *edges;
+	u32 cap;
+
+	if (nr_edges <= dag_task->max_nr_edges)
+		return 0;
+
+	if (nr_edges > DAG_TASK_MAX_EDGES)
+		return -E2BIG;
+
+	cap = max_t(u32, dag_task->max_nr_edges * 2, DAG_TASK_INIT_EDGES);
+	cap = clamp_t(u32, cap, nr_edges, DAG_TASK_MAX_EDGES);
+
+	edges = krealloc_array(dag_task->edges, cap, sizeof(*edges), GFP_ATOMIC | __GFP_NOWARN);
+	if (!edges)
+		return -ENOMEM;
+	dag_task->edges = edges;
+
+	if (dag_hash_reserve(&dag_task->edge_index, cap))
+		return -ENOMEM;
+
+	dag_task->max_nr_edges = cap;
+	return 0;
+}
+
+static void bpf_dag_task_invalidate_csr(struct bpf_dag_task *dag_task)
+{
+	dag_task->csr_valid = false;
+	/*
+	 * Priorities computed for the old shape can't be updated incrementally.
+	 */
+	dag_task->prio_policy = BPF_DAG_PRIO_NONE;
+	dag_task->slack_valid = false;
+}
+
+/*
+ * Builds the CSR adjacency of @dag_task from dag_task->edges if it is stale.
+ * This is a counting sort over the edges, so it takes O(nr_nodes + nr_edges).
+ */
+static s32 bpf_dag_task_build_csr(struct bpf_dag_task *dag_task)
+{
+	u32 nr_nodes = dag_task->nr_nodes;
+	u32 nr_edges = dag_task->nr_edges;
+	u32 *csr, *out_offs, *outs, *in_offs, *ins;
+	u32 *cursor = dag_task->buf;
+
+	if (dag_task->csr_valid)
+		return 0;
+
+	csr = kmalloc_array(2 * (nr_nodes + 1) + 2 * nr_edges, sizeof(u32),
+			    GFP_ATOMIC | __GFP_NOWARN);
+	if (!csr)
+		return -ENOMEM;
+
+	out_offs = csr;
+	in_offs = out_offs + nr_nodes + 1;
+	outs = in_offs + nr_nodes + 1;
+	ins = outs + nr_edges;
+
+	out_offs[0] = 0;
+	in_offs[0] = 0;
+	for (int i = 0; i < nr_nodes; i++) {
+		out_offs[i + 1] = out_offs[i] + dag_task->nodes[i].nr_outs;
+		in_offs[i + 1] = in_offs[i] + dag_task->nodes[i].nr_ins;
+	}
+
+	for (int i = 0; i < nr_nodes; i++)
+		cursor[i] = out_offs[i];
+	for (int i = 0; i < nr_edges; i++) {
+		struct edge_info *edge = &dag_task->edges[i];
+
+		outs[cursor[edge->from]++] = edge->to;
+	}
+
+	for (int i = 0; i < nr_nodes; i++)
+		cursor[i] = in_offs[i];
+	for (int i = 0; i < nr_edges; i++) {
+		struct edge_info *edge = &dag_task->edges[i];
+
+		ins[cursor[edge->to]++] = edge->from;
+	}
+
+	/*
+	 * out_offs points to the head of the CSR block.
+	 */
+	kfree(dag_task->out_offs);
+	dag_task->out_offs = out_offs;
+	dag_task->outs = outs;
+	dag_task->in_offs = in_offs;
+	dag_task->ins = ins;
+	dag_task->csr_valid = true;
+
+	return 0;
+}
+
+/*
+ * Repacks @dag_task into the read-optimized layout used after commit.
+ *
+ * The per-node arrays read while computing priorities and slack are placed at
+ * the head of a single block, each starting on its own cache line, and the CSR
+ * adjacency, buf and queued follow them. The runtime estimates and the ready
+ * queue entries of the nodes, and the priorities and the pending counts of the
+ * job instances are allocated at the end. The edge
+ * list and the edge index are only needed while the graph is being built, so
+ * they are released here.
+ */
+static s32 bpf_dag_task_freeze(struct bpf_dag_task *dag_task)
+{
+	u32 nr_nodes = dag_task->nr_nodes;
+	u32 nr_edges = dag_task->nr_edges;
+	size_t prio_off, weight_off, rank_off, order_off, pos_off, earliest_start_off, latest_start_off;
+	size_t csr_off, buf_off, queued_off;
+	size_t est_off, exec_start_off, rq_entries_off, jobs_off, job_size, size;
+	u32 *out_offs, *in_offs, *outs, *ins;
+	void *frozen;
+	s32 err;
+
+	err = bpf_dag_task_build_csr(dag_task);
+	if (err)
+		return err;
+
+	prio_off = 0;
+	weight_off = prio_off + ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	rank_off = weight_off + ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	order_off = rank_off + ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	pos_off = order_off + ALIGN(nr_nodes * sizeof(u32), SMP_CACHE_BYTES);
+	earliest_start_off = pos_off + ALIGN(nr_nodes * sizeof(u32), SMP_CACHE_BYTES);
+	latest_start_off = earliest_start_off + ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	csr_off = latest_start_off + ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	buf_off = csr_off + (2 * (nr_nodes + 1) + 2 * nr_edges) * sizeof(u32);
+	queued_off = ALIGN(buf_off + nr_nodes * sizeof(u32), sizeof(unsigned long));
+	est_off = ALIGN(queued_off + BITS_TO_LONGS(nr_nodes) * sizeof(unsigned long), SMP_CACHE_BYTES);
+	exec_start_off = est_off + nr_nodes * sizeof(struct bpf_dag_runtime_est);
+	rq_entries_off = ALIGN(exec_start_off + nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	jobs_off = ALIGN(rq_entries_off + nr_nodes * sizeof(struct dag_rq_entry), SMP_CACHE_BYTES);
+	job_size = ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES) +
+		   ALIGN(nr_nodes * sizeof(atomic_t), SMP_CACHE_BYTES);
+	size = jobs_off + DAG_TASK_MAX_JOBS * job_size;
+
+	frozen = kmalloc(size, GFP_ATOMIC | __GFP_NOWARN);
+	if (!frozen)
+		return -ENOMEM;
+
+	memcpy(frozen + prio_off, dag_task->prio, nr_nodes * sizeof(s64));
+	memcpy(frozen + weight_off, dag_task->weight, nr_nodes * sizeof(s64));
+	memcpy(frozen + rank_off, dag_task->rank, nr_nodes * sizeof(s64));
+	memcpy(frozen + order_off, dag_task->order, nr_nodes * sizeof(u32));
+	memcpy(frozen + pos_off, dag_task->pos, nr_nodes * sizeof(u32));
+	memcpy(frozen + earliest_start_off, dag_task->earliest_start, nr_nodes * sizeof(s64));
+	memcpy(frozen + latest_start_off, dag_task->latest_start, nr_nodes * sizeof(s64));
+	bitmap_zero(frozen + queued_off, nr_nodes);
+	memset(frozen + est_off, 0, nr_nodes * sizeof(struct bpf_dag_runtime_est));
+	memset(frozen + exec_start_off, 0xff, nr_nodes * sizeof(s64)); // -1
+
+	out_offs = frozen + csr_off;
+	in_offs = out_offs + nr_nodes + 1;
+	outs = in_offs + nr_nodes + 1;
+	ins = outs + nr_edges;
+	memcpy(out_offs, dag_task->out_offs, (nr_nodes + 1) * sizeof(u32));
+	memcpy(in_offs, dag_task->in_offs, (nr_nodes + 1) * sizeof(u32));
+	memcpy(outs, dag_task->outs, nr_edges * sizeof(u32));
+	memcpy(ins, dag_task->ins, nr_edges * sizeof(u32));
+
+	kfree(dag_task->prio);
+	kfree(dag_task->weight);
+	kfree(dag_task->rank);
+	kfree(dag_task->order);
+	kfree(dag_task->pos);
+	kfree(dag_task->earliest_start);
+	kfree(dag_task->latest_start);
+	kfree(dag_task->out_offs);
+	kfree(dag_task->buf);
+	kfree(dag_task->queued);
+	kfree(dag_task->edges);
+	dag_hash_destroy(&dag_task->edge_index);
+
+	dag_task->prio = frozen + prio_off;
+	dag_task->weight = frozen + weight_off;
+	dag_task->rank = frozen + rank_off;
+	dag_task->order = frozen + order_off;
+	dag_task->pos = frozen + pos_off;
+	dag_task->earliest_start = frozen + earliest_start_off;
+	dag_task->latest_start = frozen + latest_start_off;
+	dag_task->out_offs = out_offs;
+	dag_task->in_offs = in_offs;
+	dag_task->outs = outs;
+	dag_task->ins = ins;
+	dag_task->buf = frozen + buf_off;
+	dag_task->queued = frozen + queued_off;
+	dag_task->est = frozen + est_off;
+	dag_task->exec_start = frozen + exec_start_off;
+	dag_task->rq_entries = frozen + rq_entries_off;
+	for (int i = 0; i < nr_nodes; i++) {
+		struct dag_rq_entry *entry = &dag_task->rq_entries[i];
+
+		RB_CLEAR_NODE(&entry->rb_node);
+		entry->rq = NULL;
+		entry->dag_id = dag_task->id;
+		entry->node_id = i;
+		entry->tid = dag_task->nodes[i].tid;
+	}
+	for (int i = 0; i < DAG_TASK_MAX_JOBS; i++) {
+		dag_task->jobs[i].seq = 0;
+		atomic_set(&dag_task->jobs[i].users, 0);
+		dag_task->jobs[i].prio = frozen + jobs_off + i * job_size;
+		dag_task->jobs[i].pending = (void *)dag_task->jobs[i].prio +
+					    ALIGN(nr_nodes * sizeof(s64), SMP_CACHE_BYTES);
+	}
+	dag_task->edges = NULL;
+	dag_task->max_nr_edges = 0;
+	dag_task->frozen = frozen;
+
+	return 0;
+}
+
+/*
+ * Releases the storage of @dag_task and @dag_task itself.
+ */
+static void bpf_dag_task_destroy(struct bpf_dag_task *dag_task)
+{
+	if (dag_task->frozen) {
+		dag_rq_remove_all(dag_task);
+		kfree(dag_task->frozen);
+	} else {
+		kfree(dag_task->prio);
+		kfree(dag_task->weight);
+		kfree(dag_task->rank);
+		kfree(dag_task->order);
+		kfree(dag_task->pos);
+		kfree(dag_task->earliest_start);
+		kfree(dag_task->latest_start);
+		kfree(dag_task->out_offs);
+		kfree(dag_task->buf);
+		kfree(dag_task->queued);
+		kfree(dag_task->edges);
+	}
+	kfree(dag_task->nodes);
+	free_cpumask_var(dag_task->cpus);
+	dag_hash_destroy(&dag_task->tid_index);
+	dag_hash_destroy(&dag_task->edge_index);
+	kmem_cache_free(bpf_dag_task_manager.cachep, dag_task);
+}
+
+static bool bpf_dag_task_manager_is_well_formed(void)
+{
+	struct bpf_dag_task *dag_task;
+	unsigned long flags;
+	u32 inuse_cnt;
+	bool ret = true;
+	int id;
+
+	inuse_cnt = 0;
+	spin_lock_irqsave(&bpf_dag_task_manager.lock, flags);
+	idr_for_each_entry(&bpf_dag_task_manager.idr, dag_task, id) {
+		inuse_cnt++;
+		if (dag_task->id != id || !bpf_dag_task_is_well_formed(dag_task)) {
+			ret = false;
+			break;
+		}
+	}
+	if (bpf_dag_task_manager.nr_dag_tasks != inuse_cnt)
+		ret = false;
+	spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+
+	return ret;
+}
+
+static __init int bpf_dag_task_manager_init(void)
+{
+	pr_info("[*] bpf_dag_task_manager_init");
+
+	spin_lock_init(&bpf_dag_task_manager.lock);
+	bpf_dag_task_manager.nr_dag_tasks = 0;
+	idr_init(&bpf_dag_task_manager.idr);
+
+	bpf_dag_task_manager.cachep = KMEM_CACHE(bpf_dag_task, SLAB_HWCACHE_ALIGN);
+	if (!bpf_dag_task_manager.cachep)
+		return -ENOMEM;
+
+	DAG_BPF_DEBUG_CHECK(bpf_dag_task_manager_is_well_formed());
+
+	return 0;
+}
+
+static void bpf_dag_task_manager_exit(void)
+{
+	WARN_ON(bpf_dag_task_manager.nr_dag_tasks);
+	idr_destroy(&bpf_dag_task_manager.idr);
+	kmem_cache_destroy(bpf_dag_task_manager.cachep);
+}
+
+/*
+ * Publishes @dag_task to the manager and assigns its id.
+ * Returns 0 on success, or a negative errno if the limit has been reached.
+ */
+static s32 bpf_dag_task_manager_add(struct bpf_dag_task *dag_task)
+{
+	unsigned long flags;
+	s32 id;
+
+	spin_lock_irqsave(&bpf_dag_task_manager.lock, flags);
+	if (bpf_dag_task_manager.nr_dag_tasks >= READ_ONCE(max_dag_tasks)) {
+		spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+		return -ENOSPC;
+	}
+
+	id = idr_alloc(&bpf_dag_task_manager.idr, dag_task, 0, DAG_TASK_MAX_IDS, GFP_ATOMIC);
+	if (id < 0) {
+		spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+		return id;
+	}
+	dag_task->id = id;
+	bpf_dag_task_manager.nr_dag_tasks++;
+	spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+
+	return 0;
+}
+
+/*
+ * Removes @dag_task from the manager and releases its memory.
+ */
+static void bpf_dag_task_manager_remove(struct bpf_dag_task *dag_task)
+{
+	struct bpf_dag_task *removed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bpf_dag_task_manager.lock, flags);
+	removed = idr_remove(&bpf_dag_task_manager.idr, dag_task->id);
+	if (!WARN_ON(removed != dag_task))
+		bpf_dag_task_manager.nr_dag_tasks--;
+	spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+
+	bpf_dag_task_destroy(dag_task);
+}
+
+// MARK: bpf_dag_task API
+/*
+ * Updates the earliest start of @to and the critical path of @dag_task for a
+ * new edge (@from -> @to). Edges always go from a smaller node id to a larger
+ * one, so as long as the edges are added in the order of their sources, which
+ * is what userspace does, no node gains a predecessor after its successors
+ * and a single relaxation is exact. Otherwise the critical path is marked
+ * stale and recomputed when it's needed.
+ */
+static void bpf_dag_task_relax_edge(struct bpf_dag_task *dag_task, u32 from, u32 to)
+{
+	s64 start = dag_task->earliest_start[from] + dag_task->weight[from];
+
+	if (start <= dag_task->earliest_start[to])
+		return;
+
+	dag_task->earliest_start[to] = start;
+	if (dag_task->nodes[to].nr_outs)
+		dag_task->critical_path_stale = true;
+	else
+		dag_task->critical_path = max(dag_task->critical_path, start + dag_task->weight[to]);
+}
+
+static s32 __bpf_dag_task_add_node(struct bpf_dag_task *dag_task, u32 tid, s64 weight)
+{
+	s32 node_id, err;
+
+	if (dag_task->committed) {
+		pr_warn("bpf_dag_task_add_node: DAG task (%d) has already been committed.", dag_task->id);
+		return -1;
+	}
+
+	err = bpf_dag_task_reserve_nodes(dag_task, dag_task->nr_nodes + 1);
+	if (err == -E2BIG) {
+		pr_warn("bpf_dag_task_add_node: The maximum number of DAG nodes (%d) has been reached.", DAG_TASK_MAX_NODES);
+		return -1;
+	} else if (err) {
+		pr_warn("bpf_dag_task_add_node: Failed to grow the node storage (%d).", err);
+		return -1;
+	}
+
+	if (get_node_id(dag_task, tid) >= 0) {
+		pr_warn("bpf_dag_task_add_node: The node (tid=%d) already exists.", tid);
+		return -1;
+	}
+
+	node_id = dag_task->nr_nodes;
+	if (dag_hash_insert(&dag_task->tid_index, tid, node_id)) {
+		pr_warn("bpf_dag_task_add_node: Failed to grow the tid index.");
+		return -1;
+	}
+	dag_task->nr_nodes++;
+	dag_task->nodes[node_id].tid = tid;
+	dag_task->weight[node_id] = weight;
+	dag_task->prio[node_id] = 0;
+	dag_task->nodes[node_id].nr_ins = 0;
+	dag_task->nodes[node_id].nr_outs = 0;
+	dag_task->earliest_start[node_id] = 0;
+	dag_task->volume += weight;
+	dag_task->critical_path = max(dag_task->critical_path, weight);
+	bpf_dag_task_invalidate_csr(dag_task);
+
+	DAG_BPF_DEBUG_CHECK(bpf_dag_task_manager_is_well_formed());
+
+	return node_id;
+}
+
+/*
+ * Adds an edge between the nodes @from and @to, given by their node ids, to
+ * @dag_task, which must not be committed yet.
+ * Returns the edge id, or -1 if the edge is invalid or can't be stored.
+ */
+static s32 bpf_dag_task_add_edge_by_id(struct bpf_dag_task *dag_task, s32 from, s32 to)
+{
+	s32 edge_id, err;
+
+	// from and to are valid!
+	WARN_ON_ONCE(!(0 <= from && from < dag_task->nr_nodes));
+	WARN_ON_ONCE(!(0 <= to && to < dag_task->nr_nodes));
+
+	if (get_edge_id(dag_task, from, to) >= 0) {
+		pr_warn("Edge (%d -> %d) already exists in DAG task (%d)",
+			from, to, dag_task->id);
+		return -1;
+	}
 
 	if (from == to) {
 		pr_warn("Self-loop (%d -> %d) is not allowed.", from, to);
 		return -1;
 	}
 
-	if (from > to) {
-		pr_warn("Edge (%d -> %d) violates topological order", from, to);
-		return -1;
+	if (from > to) {
+		pr_warn("Edge (%d -> %d) violates topological order", from, to);
+		return -1;
+	}
+
+	err = bpf_dag_task_reserve_edges(dag_task, dag_task->nr_edges + 1);
+	if (err == -E2BIG) {
+		pr_warn("The maximum number of DAG edges (%d) has been reached.", DAG_TASK_MAX_EDGES);
+		return -1;
+	} else if (err) {
+		pr_warn("Failed to grow the edge storage (%d).", err);
+		return -1;
+	}
+
+	edge_id = dag_task->nr_edges;
+	if (dag_hash_insert(&dag_task->edge_index, edge_key(from, to), edge_id)) {
+		pr_warn("Failed to grow the edge index.");
+		return -1;
+	}
+	dag_task->nr_edges++;
+
+	dag_task->edges[edge_id].from = from;
+	dag_task->edges[edge_id].to = to;
+
+	dag_task->nodes[from].nr_outs++;
+	dag_task->nodes[to].nr_ins++;
+	bpf_dag_task_relax_edge(dag_task, from, to);
+	bpf_dag_task_invalidate_csr(dag_task);
+
+	DAG_BPF_DEBUG_CHECK(bpf_dag_task_manager_is_well_formed());
+
+	return edge_id;
+}
+
+static s32 __bpf_dag_task_add_edge(struct bpf_dag_task *dag_task, u32 from_tid, u32 to_tid)
+{
+	s32 from, to;
+
+	if (dag_task->committed) {
+		pr_warn("DAG task (%d) has already been committed.", dag_task->id);
+		return -1;
+	}
+
+	from = get_node_id(dag_task, from_tid);
+	to = get_node_id(dag_task, to_tid);
+
+	if (from < 0 || to < 0) {
+		pr_err("There isn't a corresponding node (from_tid=%d, to_tid=%d)", from_tid, to_tid);
+		return -1;
+	}
+
+	return bpf_dag_task_add_edge_by_id(dag_task, from, to);
+}
+
+static s32 bpf_dag_task_init(struct bpf_dag_task *dag_task, u32 src_node_tid, s64 src_node_weight,
+			     s64 relative_deadline, s64 period)
+{
+	s32 ret;
+
+	dag_task->nr_nodes = 0;
+	dag_task->nr_edges = 0;
+	dag_task->volume = 0;
+	dag_task->critical_path = 0;
+	dag_task->critical_path_stale = false;
+	spin_lock_init(&dag_task->lock);
+	bpf_dag_task_invalidate_csr(dag_task);
+
+	if (!zalloc_cpumask_var(&dag_task->cpus, GFP_ATOMIC))
+		return -ENOMEM;
+
+	dag_task->relative_deadline = relative_deadline;
+	dag_task->deadline = -1;
+	dag_task->period = period;
+
+	/*
+	 * Adds a source node. The node id of the source node is always 0.
+	 */
+	ret = __bpf_dag_task_add_node(dag_task, src_node_tid, src_node_weight);
+	if (ret < 0)
+		return -ENOMEM;
+	WARN_ON(ret != 0);
+	WARN_ON(dag_task->nr_nodes != 1);
+	WARN_ON(dag_task->nr_edges != 0);
+
+	DAG_BPF_DEBUG_CHECK(bpf_dag_task_manager_is_well_formed());
+
+	return 0;
+}
+
+/*
+ * Allocates a DAG task with only the source node and publishes it to the
+ * manager. Returns NULL on failure.
+ */
+static struct bpf_dag_task *bpf_dag_task_create(u32 src_node_tid, s64 src_node_weight,
+						s64 relative_deadline, s64 period)
+{
+	struct bpf_dag_task *dag_task;
+	s32 err;
+
+	dag_task = kmem_cache_zalloc(bpf_dag_task_manager.cachep, GFP_ATOMIC);
+	if (!dag_task) {
+		pr_warn("Failed to allocate a DAG task.");
+		return NULL;
+	}
+
+	err = bpf_dag_task_init(dag_task, src_node_tid, src_node_weight, relative_deadline, period);
+	if (err) {
+		pr_err("Failed to init a DAG task.");
+		bpf_dag_task_destroy(dag_task);
+		return NULL;
+	}
+
+	err = bpf_dag_task_manager_add(dag_task);
+	if (err) {
+		pr_err("There is no slots for a DAG task (max_dag_tasks=%u).", max_dag_tasks);
+		bpf_dag_task_destroy(dag_task);
+		return NULL;
+	}
+
+	return dag_task;
+}
+
+// MARK: bpf_dag_task prio
+#define DAG_PRIO_TIME_LSB	(DAG_PRIO_DAG_BITS + DAG_PRIO_RANK_BITS)
+
+/*
+ * Packs @time_ns, @dag_id and @rank into a priority key. See DAG_PRIO_RANK_BITS.
+ * Times before 0 or beyond the key range are clamped.
+ */
+static s64 dag_prio_encode(s64 time_ns, u32 dag_id, u32 rank)
+{
+	const s64 time_max = (1LL << (63 - DAG_PRIO_TIME_LSB + DAG_PRIO_TIME_SHIFT)) - 1;
+	s64 time = clamp_t(s64, time_ns, 0, time_max) >> DAG_PRIO_TIME_SHIFT;
+
+	BUILD_BUG_ON(DAG_TASK_MAX_NODES > DAG_PRIO_RANK_MASK + 1);
+
+	return (time << DAG_PRIO_TIME_LSB) |
+	       ((s64)(dag_id & DAG_PRIO_DAG_MASK) << DAG_PRIO_RANK_BITS) |
+	       (rank & DAG_PRIO_RANK_MASK);
+}
+
+/*
+ * The HELT rank of node @i: its weight plus the largest rank of its successors.
+ */
+static s64 HELT_rank_of(struct bpf_dag_task *dag_task, u32 i)
+{
+	s64 tail_weight_max = 0;
+
+	for (u32 j = dag_task->out_offs[i]; j < dag_task->out_offs[i + 1]; j++) {
+		s64 tail_weight_curr = dag_task->rank[dag_task->outs[j]];
+		tail_weight_max = tail_weight_max < tail_weight_curr ? tail_weight_curr : tail_weight_max;
+	}
+
+	return dag_task->weight[i] + tail_weight_max;
+}
+
+/*
+ * The HLBS latest start time of node @i: the latest time at which it must
+ * begin execution for the DAG task to meet its deadline.
+ */
+static s64 HLBS_lst_of(struct bpf_dag_task *dag_task, u32 i)
+{
+	s64 tail_deadline_min;
+
+	if (dag_task->out_offs[i] == dag_task->out_offs[i + 1])
+		return dag_task->deadline - dag_task->weight[i];
+
+	tail_deadline_min = S64_MAX;
+	for (u32 j = dag_task->out_offs[i]; j < dag_task->out_offs[i + 1]; j++) {
+		s64 tail_deadline_curr = dag_task->rank[dag_task->outs[j]];
+		tail_deadline_min = tail_deadline_min < tail_deadline_curr
+			? tail_deadline_min : tail_deadline_curr;
+	}
+
+	return tail_deadline_min - dag_task->weight[i];
+}
+
+/*
+ * Fills earliest_start of @dag_task relative to the release of a job, and the
+ * critical path along with it. Node ids are in topological order, so a single
+ * forward pass over the predecessors is enough.
+ */
+static void bpf_dag_task_culc_earliest_start(struct bpf_dag_task *dag_task)
+{
+	s64 critical_path = 0;
+
+	for (u32 i = 0; i < dag_task->nr_nodes; i++) {
+		s64 start = 0;
+
+		for (u32 j = dag_task->in_offs[i]; j < dag_task->in_offs[i + 1]; j++) {
+			u32 pred = dag_task->ins[j];
+
+			start = max(start, dag_task->earliest_start[pred] + dag_task->weight[pred]);
+		}
+		dag_task->earliest_start[i] = start;
+		critical_path = max(critical_path, start + dag_task->weight[i]);
+	}
+
+	dag_task->critical_path = critical_path;
+	dag_task->critical_path_stale = false;
+}
+
+/*
+ * Recomputes the critical path of @dag_task if it's stale and the adjacency is
+ * built, which it always is once committed. Called with dag_task->lock held.
+ */
+static void bpf_dag_task_refresh_critical_path(struct bpf_dag_task *dag_task)
+{
+	if (dag_task->critical_path_stale && dag_task->csr_valid)
+		bpf_dag_task_culc_earliest_start(dag_task);
+}
+
+/*
+ * Fills earliest_start and latest_start of @dag_task relative to the release
+ * of a job, with a forward pass and then a backward pass over the successors.
+ */
+static void bpf_dag_task_culc_start_times(struct bpf_dag_task *dag_task)
+{
+	bpf_dag_task_culc_earliest_start(dag_task);
+
+	for (s32 i = dag_task->nr_nodes - 1; i >= 0; i--) {
+		s64 finish = dag_task->relative_deadline;
+
+		for (u32 j = dag_task->out_offs[i]; j < dag_task->out_offs[i + 1]; j++)
+			finish = min(finish, dag_task->latest_start[dag_task->outs[j]]);
+		dag_task->latest_start[i] = finish - dag_task->weight[i];
+	}
+
+	dag_task->slack_valid = true;
+}
+
+/*
+ * Whether node @u is less urgent than node @v. With HELT, nodes are ordered by
+ * (rank, node id) in ascending order. With HLBS, rank is the latest start
+ * time, and nodes are ordered by (rank, node id) in descending order, so a
+ * later start time is less urgent and ties go to the smaller node id, i.e.
+ * in topological order.
+ */
+static bool node_rank_less(struct bpf_dag_task *dag_task, u32 u, u32 v)
+{
+	if (dag_task->prio_policy == BPF_DAG_PRIO_HLBS) {
+		if (dag_task->rank[u] != dag_task->rank[v])
+			return dag_task->rank[u] > dag_task->rank[v];
+		return u > v;
+	}
+
+	if (dag_task->rank[u] != dag_task->rank[v])
+		return dag_task->rank[u] < dag_task->rank[v];
+	return u < v;
+}
+
+static int cmp_node_by_rank(const void *a, const void *b, const void *priv)
+{
+	struct bpf_dag_task *dag_task = (struct bpf_dag_task *)priv;
+	u32 u = *(const u32 *)a, v = *(const u32 *)b;
+
+	if (u == v)
+		return 0;
+	return node_rank_less(dag_task, u, v) ? -1 : 1;
+}
+
+/*
+ * The time packed into the priority key of node @i: the deadline with HELT,
+ * and the latest start time with HLBS, relative to @deadline.
+ */
+static s64 node_prio_time(struct bpf_dag_task *dag_task, u32 i, s64 deadline)
+{
+	if (dag_task->prio_policy == BPF_DAG_PRIO_HLBS)
+		return deadline - (dag_task->deadline - dag_task->rank[i]);
+	return deadline;
+}
+
+/*
+ * Stores the priorities of the nodes at order[lo] .. order[hi].
+ *
+ * The priority key packs the time and the position in order[], so when
+ * sorted in ascending order of prio:
+ *   - nodes with earlier times (deadlines or latest start times) are prioritized,
+ *   - and among nodes in the same DAG task, the order of order[] is kept
+ *     exactly, even if their times share a unit of the key.
+ */
+static void assign_prio(struct bpf_dag_task *dag_task, u32 lo, u32 hi)
+{
+	for (u32 i = lo; i <= hi; i++) {
+		u32 node = dag_task->order[i];
+
+		dag_task->pos[node] = i;
+		dag_task->prio[node] = dag_prio_encode(node_prio_time(dag_task, node, dag_task->deadline),
+						       dag_task->id, DAG_PRIO_RANK_MASK - i);
+	}
+}
+
+static void sort_node_by_rank(struct bpf_dag_task *dag_task)
+{
+	u32 *order = dag_task->order;
+
+	for (int i = 0; i < dag_task->nr_nodes; i++)
+		order[i] = i;
+
+	sort_r(order, dag_task->nr_nodes, sizeof(*order), cmp_node_by_rank, NULL, dag_task);
+
+	for (int i = 1; i < dag_task->nr_nodes; i++)
+		DAG_BPF_DEBUG_CHECK(node_rank_less(dag_task, order[i - 1], order[i]));
+}
+
+/*
+ * Moves node @u to the position in order[] that matches its new rank.
+ * The position is found by binary search, and only @u and the nodes between
+ * the old and the new position get new priorities.
+ */
+static void reposition_node(struct bpf_dag_task *dag_task, u32 u)
+{
+	u32 *order = dag_task->order;
+	u32 p = dag_task->pos[u];
+	u32 lo, hi;
+
+	if (p + 1 < dag_task->nr_nodes && node_rank_less(dag_task, order[p + 1], u)) {
+		/*
+		 * Moves right, behind the last node that is less than @u.
+		 */
+		lo = p + 1;
+		hi = dag_task->nr_nodes;
+		while (lo < hi) {
+			u32 mid = lo + (hi - lo) / 2;
+
+			if (node_rank_less(dag_task, order[mid], u))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		memmove(&order[p], &order[p + 1], (lo - 1 - p) * sizeof(*order));
+		order[lo - 1] = u;
+		assign_prio(dag_task, p, lo - 1);
+	} else if (p > 0 && node_rank_less(dag_task, u, order[p - 1])) {
+		/*
+		 * Moves left, in front of the first node that is greater than @u.
+		 */
+		lo = 0;
+		hi = p;
+		while (lo < hi) {
+			u32 mid = lo + (hi - lo) / 2;
+
+			if (node_rank_less(dag_task, u, order[mid]))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		memmove(&order[lo + 1], &order[lo], (p - lo) * sizeof(*order));
+		order[lo] = u;
+		assign_prio(dag_task, lo, p);
+	} else {
+		/*
+		 * Stays, but the time in its key may have changed (HLBS).
+		 */
+		assign_prio(dag_task, p, p);
+	}
+}
+
+/*
+ * A max-heap of node ids used as the worklist of the incremental update.
+ * Every edge goes from a smaller node id to a larger one, so popping the
+ * largest id first visits the nodes in reverse topological order.
+ */
+static void node_heap_push(u32 *heap, u32 *nr, u32 node)
+{
+	u32 i = (*nr)++;
+
+	while (i > 0) {
+		u32 parent = (i - 1) / 2;
+
+		if (heap[parent] >= node)
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = node;
+}
+
+static u32 node_heap_pop(u32 *heap, u32 *nr)
+{
+	u32 top = heap[0];
+	u32 last = heap[--(*nr)];
+	u32 i = 0;
+
+	for (;;) {
+		u32 child = 2 * i + 1;
+
+		if (child >= *nr)
+			break;
+		if (child + 1 < *nr && heap[child + 1] > heap[child])
+			child++;
+		if (heap[child] <= last)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+
+	return top;
+}
+
+/*
+ * Adds @node to the worklist of the incremental update unless it is already there.
+ */
+static void bpf_dag_task_queue_node(struct bpf_dag_task *dag_task, u32 *nr_heap, u32 node)
+{
+	if (!__test_and_set_bit(node, dag_task->queued))
+		node_heap_push(dag_task->buf, nr_heap, node);
+}
+
+/*
+ * Recomputes the priorities affected by weight changes of the @nr_heap nodes
+ * queued by bpf_dag_task_queue_node().
+ *
+ * Only those nodes and their ancestors can change. They are visited in reverse
+ * topological order, and the propagation stops at nodes whose value didn't
+ * change. A node whose value changed is repositioned in order[].
+ *
+ * Returns the number of nodes whose value (HLBS latest start time or HELT rank) changed.
+ */
+static u32 bpf_dag_task_propagate_prio(struct bpf_dag_task *dag_task, u32 nr_heap)
+{
+	u32 *heap = dag_task->buf;
+	unsigned long *queued = dag_task->queued;
+	u32 nr_changed = 0;
+
+	while (nr_heap) {
+		u32 u = node_heap_pop(heap, &nr_heap);
+
+		/*
+		 * Nodes pushed from now on are predecessors of nodes smaller
+		 * than @u, so @u will never be pushed again.
+		 */
+		__clear_bit(u, queued);
+
+		s64 rank = dag_task->prio_policy == BPF_DAG_PRIO_HELT
+			? HELT_rank_of(dag_task, u) : HLBS_lst_of(dag_task, u);
+
+		if (rank == dag_task->rank[u])
+			continue;
+		dag_task->rank[u] = rank;
+		reposition_node(dag_task, u);
+		nr_changed++;
+
+		for (u32 j = dag_task->in_offs[u]; j < dag_task->in_offs[u + 1]; j++)
+			bpf_dag_task_queue_node(dag_task, &nr_heap, dag_task->ins[j]);
+	}
+
+	return nr_changed;
+}
+
+// MARK: bpf_dag_task job
+/*
+ * Returns the active job whose handle is @seq with a reference, or NULL.
+ * The slot isn't reused until the reference is dropped by bpf_dag_task_put_job(),
+ * even if the job completes in the meantime.
+ */
+static struct bpf_dag_job *bpf_dag_task_get_job(struct bpf_dag_task *dag_task, u64 seq)
+{
+	struct bpf_dag_job *job;
+
+	if (!dag_task->committed || seq == 0)
+		return NULL;
+
+	job = &dag_task->jobs[seq % DAG_TASK_MAX_JOBS];
+	if (smp_load_acquire(&job->seq) != seq)
+		return NULL;
+
+	if (!atomic_inc_not_zero(&job->users))
+		return NULL;
+
+	/*
+	 * The job may have completed and the slot may have been reused before
+	 * the reference was taken.
+	 */
+	if (smp_load_acquire(&job->seq) != seq) {
+		atomic_dec(&job->users);
+		return NULL;
+	}
+
+	return job;
+}
+
+static void bpf_dag_task_put_job(struct bpf_dag_job *job)
+{
+	smp_mb__before_atomic(); // the accesses to the slot happen before its reuse
+	atomic_dec(&job->users);
+}
+
+/*
+ * Fills the priorities of @job from the ranks last computed for @dag_task,
+ * with the deadline of @job.
+ */
+static void bpf_dag_task_job_assign_prio(struct bpf_dag_task *dag_task, struct bpf_dag_job *job)
+{
+	for (u32 i = 0; i < dag_task->nr_nodes; i++)
+		job->prio[i] = dag_prio_encode(node_prio_time(dag_task, i, job->deadline),
+					       dag_task->id, DAG_PRIO_RANK_MASK - dag_task->pos[i]);
+}
+
+// MARK: bpf_dag_task est
+/*
+ * The percentile of the runtime of a node tracked as its WCET-like estimate,
+ * in per-mille.
+ */
+static unsigned int est_pctl = 950;
+module_param(est_pctl, uint, 0644);
+MODULE_PARM_DESC(est_pctl, "The percentile (per-mille) of the node runtimes tracked by the estimator");
+
+/*
+ * The smallest step of the percentile estimate in ns.
+ */
+#define DAG_EST_MIN_STEP	1000
+
+/*
+ * Returns the CPU time consumed so far by the thread @tid in ns, or -ESRCH.
+ * sum_exec_runtime is brought up to date on every context switch of the
+ * thread, so the value is exact when it's read around one.
+ */
+static s64 dag_task_exec_runtime(u32 tid)
+{
+	struct task_struct *p;
+	s64 runtime = -ESRCH;
+
+	rcu_read_lock();
+	p = pid_task(find_pid_ns(tid, &init_pid_ns), PIDTYPE_PID);
+	if (p)
+		runtime = READ_ONCE(p->se.sum_exec_runtime);
+	rcu_read_unlock();
+
+	return runtime;
+}
+
+/*
+ * Feeds a measured @runtime into @est.
+ *
+ * The EWMA follows the mean with a gain of 1/8. The percentile is tracked by a
+ * stochastic quantile estimator: it moves up by step * p when a sample lies
+ * above it and down by step * (1 - p) when a sample lies below it, so it
+ * settles where a fraction p of the samples are below it. The step scales
+ * with the EWMA, so it adapts to the magnitude of the runtime.
+ */
+static void dag_runtime_est_update(struct bpf_dag_runtime_est *est, s64 runtime)
+{
+	u32 pctl = min_t(u32, READ_ONCE(est_pctl), 1000);
+	s64 step;
+
+	est->last = runtime;
+	if (est->nr_samples++ == 0) {
+		est->ewma = runtime;
+		est->pctl = runtime;
+		return;
+	}
+
+	est->ewma += (runtime - est->ewma) >> 3;
+
+	step = max_t(s64, est->ewma >> 4, DAG_EST_MIN_STEP);
+	if (runtime > est->pctl)
+		est->pctl += div_s64(step * pctl, 1000);
+	else if (runtime < est->pctl)
+		est->pctl = max_t(s64, est->pctl - div_s64(step * (1000 - pctl), 1000), 0);
+}
+
+// MARK: sys_info
+/*
+ * This implementation manages per-CPU information, including:
+ *   - the current thread running on each CPU
+ *   - its current priority, a key encoded like bpf_dag_task_get_prio()
+ *     (see DAG_PRIO_RANK_BITS). -1 means no priority.
+ *
+ * Each CPU has its own slot. Writers of a slot are serialized by its lock,
+ * and readers are lock-free thanks to its seqcount.
+ *
+ * The CPU with the highest priority is tracked by a tournament tree over the
+ * slots. The internal node k holds the winner of its children 2k and 2k + 1,
+ * and the leaf of a CPU is the node nr_leaves + cpu_leaf[cpu]. An update
+ * refreshes the O(log nr_cpus) ancestors of its leaf with cmpxchg, and the
+ * maximum is read from the root in O(1).
+ *
+ * The leaves are sorted by (NUMA node, LLC, cpu), so the CPUs of an LLC or of
+ * a node are a contiguous range of leaves, and the maximum within it is read
+ * from the O(log nr_cpus) subtrees covering the range.
+ *
+ * A CPU can be reserved as a preemption victim. A reserved CPU counts as
+ * having the priority -1 until it is released or its priority is updated,
+ * so concurrent wakers don't pick the same victim.
+ *
+ * The slots are allocated by the percpu allocator and the tree covers all
+ * possible CPUs. A slot is reset whenever its CPU comes online or goes offline.
+ */
+#define SYS_INFO_NO_CPU U32_MAX
+
+struct cpu_info {
+	raw_spinlock_t lock; /* serializes writers of this slot */
+	seqcount_raw_spinlock_t seq;
+	s32 curr_pid;
+	s64 curr_prio;
+	bool reserved;
+} ____cacheline_aligned_in_smp;
+
+struct sys_info_desc {
+	struct cpu_info __percpu *cpus;
+	u32 nr_cpus; /* nr_cpu_ids */
+	u32 nr_leaves; /* a power of two */
+	u32 *leaf_cpu; /* leaf -> cpu */
+	u32 *cpu_leaf; /* cpu -> leaf */
+	/*
+	 * Internal nodes 1 .. nr_leaves - 1. The lower 32 bits are the
+	 * winner CPU, and the upper 32 bits are a version that avoids ABA.
+	 */
+	atomic64_t *tree;
+};
+
+struct sys_info_desc sys_info_desc;
+
+/*
+ * The dynamic CPU hotplug state of sys_info.
+ */
+static enum cpuhp_state sys_info_cpuhp_state;
+
+/*
+ * The CPUs sharing the last level cache with @cpu. Only x86 exposes it to
+ * modules, so other architectures fall back to the NUMA node.
+ */
+static const struct cpumask *sys_info_llc_mask(int cpu)
+{
+#ifdef CONFIG_X86
+	return cpu_llc_shared_mask(cpu);
+#else
+	return cpumask_of_node(cpu_to_node(cpu));
+#endif
+}
+
+static int cmp_cpu_by_topology(const void *a, const void *b)
+{
+	u32 u = *(const u32 *)a, v = *(const u32 *)b;
+	u32 u_llc, v_llc;
+
+	if (cpu_to_node(u) != cpu_to_node(v))
+		return cpu_to_node(u) < cpu_to_node(v) ? -1 : 1;
+
+	u_llc = cpumask_first(sys_info_llc_mask(u));
+	v_llc = cpumask_first(sys_info_llc_mask(v));
+	if (u_llc != v_llc)
+		return u_llc < v_llc ? -1 : 1;
+
+	return u < v ? -1 : (u > v);
+}
+
+static void sys_info_refresh(struct sys_info_desc *desc, u32 k);
+
+static void sys_info_desc_destroy(struct sys_info_desc *desc)
+{
+	free_percpu(desc->cpus);
+	kfree(desc->leaf_cpu);
+	kfree(desc->cpu_leaf);
+	kfree(desc->tree);
+}
+
+/*
+ * Returns 0 on success, otherwise a negative errno.
+ */
+static int sys_info_desc_init(struct sys_info_desc *desc)
+{
+	desc->nr_cpus = nr_cpu_ids;
+	desc->nr_leaves = roundup_pow_of_two(desc->nr_cpus);
+
+	desc->cpus = alloc_percpu(struct cpu_info);
+	desc->leaf_cpu = kcalloc(desc->nr_cpus, sizeof(u32), GFP_KERNEL);
+	desc->cpu_leaf = kcalloc(desc->nr_cpus, sizeof(u32), GFP_KERNEL);
+	desc->tree = kcalloc(desc->nr_leaves, sizeof(atomic64_t), GFP_KERNEL);
+	if (!desc->cpus || !desc->leaf_cpu || !desc->cpu_leaf || !desc->tree) {
+		sys_info_desc_destroy(desc);
+		return -ENOMEM;
+	}
+
+	for (int cpu = 0; cpu < desc->nr_cpus; cpu++) {
+		struct cpu_info *cpu_info = per_cpu_ptr(desc->cpus, cpu);
+
+		raw_spin_lock_init(&cpu_info->lock);
+		seqcount_raw_spinlock_init(&cpu_info->seq, &cpu_info->lock);
+		cpu_info->curr_pid = -1;
+		cpu_info->curr_prio = -1;
+		cpu_info->reserved = false;
+		desc->leaf_cpu[cpu] = cpu;
+	}
+
+	/*
+	 * The LLC of a CPU that is offline here isn't known, so it may end up
+	 * apart from its LLC. Queries are still correct, just less local.
+	 */
+	sort(desc->leaf_cpu, desc->nr_cpus, sizeof(u32), cmp_cpu_by_topology, NULL);
+	for (u32 leaf = 0; leaf < desc->nr_cpus; leaf++)
+		desc->cpu_leaf[desc->leaf_cpu[leaf]] = leaf;
+
+	for (u32 k = desc->nr_leaves - 1; k >= 1; k--) {
+		atomic64_set(&desc->tree[k], SYS_INFO_NO_CPU);
+		sys_info_refresh(desc, k);
+	}
+
+	return 0;
+}
+
+static s32 sys_info_reset_cpu(struct sys_info_desc *desc, s32 cpu);
+
+/*
+ * A CPU that comes online must not inherit stale data, and a CPU going
+ * offline must not be picked by any query.
+ */
+static int sys_info_cpu_online(unsigned int cpu)
+{
+	sys_info_reset_cpu(&sys_info_desc, cpu);
+	return 0;
+}
+
+static int sys_info_cpu_offline(unsigned int cpu)
+{
+	sys_info_reset_cpu(&sys_info_desc, cpu);
+	return 0;
+}
+
+static __init int bpf_sys_info_init(void)
+{
+	int ret;
+
+	ret = sys_info_desc_init(&sys_info_desc);
+	if (ret)
+		return ret;
+
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "dag_bpf/sys_info:online",
+				sys_info_cpu_online, sys_info_cpu_offline);
+	if (ret < 0) {
+		sys_info_desc_destroy(&sys_info_desc);
+		return ret;
+	}
+	sys_info_cpuhp_state = ret;
+
+	return 0;
+}
+
+static void bpf_sys_info_exit(void)
+{
+	cpuhp_remove_state(sys_info_cpuhp_state);
+	sys_info_desc_destroy(&sys_info_desc);
+}
+
+static u32 sys_info_node_winner(struct sys_info_desc *desc, u32 k)
+{
+	if (k >= desc->nr_leaves) {
+		u32 leaf = k - desc->nr_leaves;
+
+		return leaf < desc->nr_cpus ? desc->leaf_cpu[leaf] : SYS_INFO_NO_CPU;
+	}
+	return (u32)atomic64_read(&desc->tree[k]);
+}
+
+static s64 sys_info_read_cpu(struct sys_info_desc *desc, u32 cpu, s32 *pid)
+{
+	struct cpu_info *cpu_info;
+	unsigned int seq;
+	s64 prio;
+
+	if (cpu == SYS_INFO_NO_CPU) {
+		*pid = -1;
+		return -1;
+	}
+
+	cpu_info = per_cpu_ptr(desc->cpus, cpu);
+	do {
+		seq = read_seqcount_begin(&cpu_info->seq);
+		*pid = cpu_info->curr_pid;
+		prio = cpu_info->reserved ? -1 : cpu_info->curr_prio;
+	} while (read_seqcount_retry(&cpu_info->seq, seq));
+
+	return prio;
+}
+
+/*
+ * Returns true if (@prio, @cpu) beats (@best_prio, @best_cpu).
+ * On ties, the smaller CPU wins.
+ */
+static bool sys_info_beats(s64 prio, u32 cpu, s64 best_prio, u32 best_cpu)
+{
+	return prio > best_prio || (prio == best_prio && cpu < best_cpu);
+}
+
+/*
+ * Recomputes the winner of the internal node @k from its children.
+ */
+static void sys_info_refresh(struct sys_info_desc *desc, u32 k)
+{
+	s64 old = atomic64_read(&desc->tree[k]);
+	u32 left = sys_info_node_winner(desc, 2 * k);
+	u32 right = sys_info_node_winner(desc, 2 * k + 1);
+	s64 left_prio, right_prio;
+	u32 winner;
+	s32 pid;
+
+	left_prio = sys_info_read_cpu(desc, left, &pid);
+	right_prio = sys_info_read_cpu(desc, right, &pid);
+	winner = sys_info_beats(right_prio, right, left_prio, left) ? right : left;
+
+	atomic64_cmpxchg(&desc->tree[k], old,
+			 ((u64)((u32)((u64)old >> 32) + 1) << 32) | winner);
+}
+
+static void sys_info_propagate(struct sys_info_desc *desc, u32 cpu)
+{
+	for (u32 k = (desc->nr_leaves + desc->cpu_leaf[cpu]) / 2; k >= 1; k /= 2) {
+		/*
+		 * If the first cmpxchg loses, the winning refresh may have read
+		 * the slot before it was written. The second one starts after
+		 * the write, and either it succeeds or another refresh that
+		 * started after the write did.
+		 */
+		sys_info_refresh(desc, k);
+		sys_info_refresh(desc, k);
+	}
+}
+
+static s32 sys_info_update_cpu_prio(struct sys_info_desc *desc, s32 cpu, s32 pid, s64 prio)
+{
+	struct cpu_info *cpu_info;
+	unsigned long flags;
+
+	if (!(0 <= cpu && cpu < desc->nr_cpus))
+		return -EINVAL;
+
+	cpu_info = per_cpu_ptr(desc->cpus, cpu);
+	raw_spin_lock_irqsave(&cpu_info->lock, flags);
+	write_seqcount_begin(&cpu_info->seq);
+	cpu_info->curr_pid = pid;
+	cpu_info->curr_prio = prio;
+	cpu_info->reserved = false;
+	write_seqcount_end(&cpu_info->seq);
+	raw_spin_unlock_irqrestore(&cpu_info->lock, flags);
+
+	sys_info_propagate(desc, cpu);
+
+	return 0;
+}
+
+/*
+ * Reserves @cpu if it isn't reserved yet and still has the priority @prio.
+ * Returns true on success.
+ */
+static bool sys_info_reserve_cpu(struct sys_info_desc *desc, u32 cpu, s64 prio)
+{
+	struct cpu_info *cpu_info = per_cpu_ptr(desc->cpus, cpu);
+	unsigned long flags;
+	bool reserved = false;
+
+	raw_spin_lock_irqsave(&cpu_info->lock, flags);
+	if (!cpu_info->reserved && cpu_info->curr_prio == prio) {
+		write_seqcount_begin(&cpu_info->seq);
+		cpu_info->reserved = true;
+		write_seqcount_end(&cpu_info->seq);
+		reserved = true;
+	}
+	raw_spin_unlock_irqrestore(&cpu_info->lock, flags);
+
+	if (reserved)
+		sys_info_propagate(desc, cpu);
+
+	return reserved;
+}
+
+static s32 sys_info_reset_cpu(struct sys_info_desc *desc, s32 cpu)
+{
+	struct cpu_info *cpu_info;
+	unsigned long flags;
+
+	if (!(0 <= cpu && cpu < desc->nr_cpus))
+		return -EINVAL;
+
+	cpu_info = per_cpu_ptr(desc->cpus, cpu);
+	raw_spin_lock_irqsave(&cpu_info->lock, flags);
+	write_seqcount_begin(&cpu_info->seq);
+	cpu_info->curr_pid = -1;
+	cpu_info->curr_prio = -1;
+	cpu_info->reserved = false;
+	write_seqcount_end(&cpu_info->seq);
+	raw_spin_unlock_irqrestore(&cpu_info->lock, flags);
+
+	sys_info_propagate(desc, cpu);
+
+	return 0;
+}
+
+static s32 sys_info_release_cpu(struct sys_info_desc *desc, s32 cpu)
+{
+	struct cpu_info *cpu_info;
+	unsigned long flags;
+
+	if (!(0 <= cpu && cpu < desc->nr_cpus))
+		return -EINVAL;
+
+	cpu_info = per_cpu_ptr(desc->cpus, cpu);
+	raw_spin_lock_irqsave(&cpu_info->lock, flags);
+	write_seqcount_begin(&cpu_info->seq);
+	cpu_info->reserved = false;
+	write_seqcount_end(&cpu_info->seq);
+	raw_spin_unlock_irqrestore(&cpu_info->lock, flags);
+
+	sys_info_propagate(desc, cpu);
+
+	return 0;
+}
+
+static s32 sys_info_get_max_prio_and_cpu(struct sys_info_desc *desc, s32 *cpu, s32 *pid, s64 *prio)
+{
+	u32 max_prio_cpu = sys_info_node_winner(desc, 1);
+	s32 max_prio_pid;
+	s64 max_prio;
+
+	max_prio = sys_info_read_cpu(desc, max_prio_cpu, &max_prio_pid);
+	if (max_prio < 0)
+		return -ENOENT;
+
+	*cpu = max_prio_cpu;
+	*pid = max_prio_pid;
+	*prio = max_prio;
+	return 0;
+}
+
+/*
+ * Folds the maximum over the leaves [@lo, @hi) into (@best_cpu, @best_pid, @best_prio).
+ * This reads the winners of the O(log nr_cpus) subtrees covering the range.
+ */
+static void sys_info_range_max(struct sys_info_desc *desc, u32 lo, u32 hi,
+			       u32 *best_cpu, s32 *best_pid, s64 *best_prio)
+{
+	u32 l = desc->nr_leaves + lo, r = desc->nr_leaves + hi;
+	u32 winners[2], nr_winners;
+	s32 pid;
+	s64 prio;
+
+	for (; l < r; l /= 2, r /= 2) {
+		nr_winners = 0;
+		if (l & 1)
+			winners[nr_winners++] = sys_info_node_winner(desc, l++);
+		if (r & 1)
+			winners[nr_winners++] = sys_info_node_winner(desc, --r);
+
+		for (u32 i = 0; i < nr_winners; i++) {
+			prio = sys_info_read_cpu(desc, winners[i], &pid);
+			if (sys_info_beats(prio, winners[i], *best_prio, *best_cpu)) {
+				*best_cpu = winners[i];
+				*best_pid = pid;
+				*best_prio = prio;
+			}
+		}
+	}
+}
+
+/*
+ * Like sys_info_get_max_prio_and_cpu(), but only considers the CPUs in @mask.
+ *
+ * @mask is split into runs of CPUs whose leaves are contiguous, and each run
+ * is answered by sys_info_range_max(). An LLC or a NUMA node is a single run.
+ */
+static s32 sys_info_get_max_prio_and_cpu_in(struct sys_info_desc *desc, const struct cpumask *mask,
+					    s32 *cpu, s32 *pid, s64 *prio)
+{
+	u32 max_prio_cpu = SYS_INFO_NO_CPU;
+	s32 max_prio_pid = -1;
+	s64 max_prio = -1;
+	u32 lo = 0, hi = 0; /* the current run [lo, hi) */
+	int i;
+
+	for_each_cpu(i, mask) {
+		u32 leaf;
+
+		if (i >= desc->nr_cpus)
+			break;
+
+		leaf = desc->cpu_leaf[i];
+		if (lo < hi && leaf == hi) {
+			hi++;
+			continue;
+		}
+
+		sys_info_range_max(desc, lo, hi, &max_prio_cpu, &max_prio_pid, &max_prio);
+		lo = leaf;
+		hi = leaf + 1;
+	}
+	sys_info_range_max(desc, lo, hi, &max_prio_cpu, &max_prio_pid, &max_prio);
+
+	if (max_prio < 0)
+		return -ENOENT;
+
+	*cpu = max_prio_cpu;
+	*pid = max_prio_pid;
+	*prio = max_prio;
+	return 0;
+}
+
+/*
+ * The maximum number of victims returned by a single sys_info_get_victims().
+ */
+#define SYS_INFO_MAX_VICTIMS 32
+
+/*
+ * Fills @victims with up to @nr_victims CPUs with the largest priorities in
+ * descending order, and returns how many were found.
+ *
+ * Each round takes the maximum over the leaves that haven't been picked yet,
+ * which are O(nr_picked) ranges of leaves. With BPF_SYS_INFO_RESERVE, every
+ * victim is reserved before it is returned. A CPU that another waker has
+ * reserved or updated in the meantime is skipped.
+ */
+static s32 sys_info_get_victims(struct sys_info_desc *desc, struct bpf_sys_info_victim *victims,
+				u32 nr_victims, u32 flags)
+{
+	u32 picked[SYS_INFO_MAX_VICTIMS]; /* sorted leaves */
+	u32 nr_picked = 0, nr_found = 0;
+
+	nr_victims = min_t(u32, nr_victims, SYS_INFO_MAX_VICTIMS);
+
+	while (nr_found < nr_victims && nr_picked < SYS_INFO_MAX_VICTIMS) {
+		u32 best_cpu = SYS_INFO_NO_CPU, lo = 0, leaf, i;
+		s32 best_pid = -1;
+		s64 best_prio = -1;
+
+		for (i = 0; i < nr_picked; i++) {
+			sys_info_range_max(desc, lo, picked[i], &best_cpu, &best_pid, &best_prio);
+			lo = picked[i] + 1;
+		}
+		sys_info_range_max(desc, lo, desc->nr_cpus, &best_cpu, &best_pid, &best_prio);
+
+		if (best_prio < 0)
+			break;
+
+		leaf = desc->cpu_leaf[best_cpu];
+		for (i = nr_picked; i > 0 && picked[i - 1] > leaf; i--)
+			picked[i] = picked[i - 1];
+		picked[i] = leaf;
+		nr_picked++;
+
+		if ((flags & BPF_SYS_INFO_RESERVE) && !sys_info_reserve_cpu(desc, best_cpu, best_prio))
+			continue;
+
+		victims[nr_found].cpu = best_cpu;
+		victims[nr_found].pid = best_pid;
+		victims[nr_found].prio = best_prio;
+		nr_found++;
+	}
+
+	return nr_found;
+}
+
+static s32 __bpf_sys_info_update_cpu_prio(s32 cpu, s32 pid, s64 prio)
+{
+	return sys_info_update_cpu_prio(&sys_info_desc, cpu, pid, prio);
+}
+
+static s32 __bpf_sys_info_get_max_prio_and_cpu(s32 *cpu, s32 *pid, s64 *prio)
+{
+	return sys_info_get_max_prio_and_cpu(&sys_info_desc, cpu, pid, prio);
+}
+
+// MARK: sys_info bench
+#ifdef DAG_BPF_BENCH
+/*
+ * Compares the implementation above with the former one, which serialized
+ * every CPU on a single lock and scanned all CPUs on each query.
+ * Reading my_ops/sys_info_bench runs both on every online CPU at the same
+ * time, on private instances, so the live sys_info isn't disturbed.
+ * It's only built with `make BENCH=1`, since it keeps every CPU busy.
+ */
+#define SYS_INFO_BENCH_ITERS 1000
+#define SYS_INFO_LEGACY_MAX_NR_CPUS 512
+
+struct sys_info_legacy_desc {
+	raw_spinlock_t lock;
+	struct {
+		s32 curr_pid;
+		s64 curr_prio;
+	} cpus[SYS_INFO_LEGACY_MAX_NR_CPUS];
+};
+
+static s32 sys_info_legacy_update_cpu_prio(struct sys_info_legacy_desc *desc, s32 cpu, s32 pid, s64 prio)
+{
+	unsigned long flags;
+
+	if (!(0 <= cpu && cpu < SYS_INFO_LEGACY_MAX_NR_CPUS))
+		return -EINVAL;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	desc->cpus[cpu].curr_pid = pid;
+	desc->cpus[cpu].curr_prio = prio;
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	return 0;
+}
+
+static s32 sys_info_legacy_get_max_prio_and_cpu(struct sys_info_legacy_desc *desc, s32 *cpu, s32 *pid, s64 *prio)
+{
+	unsigned long flags;
+	s64 max_prio = -1;
+	s32 max_prio_cpu = -1;
+	s32 max_prio_pid = -1;
+
+	raw_spin_lock_irqsave(&desc->lock, flags);
+	for (int i = 0; i < nr_cpu_ids && i < SYS_INFO_LEGACY_MAX_NR_CPUS; i++) {
+		if (max_prio < desc->cpus[i].curr_prio) {
+			max_prio = desc->cpus[i].curr_prio;
+			max_prio_cpu = i;
+			max_prio_pid = desc->cpus[i].curr_pid;
+		}
+	}
+	raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+	if (max_prio_cpu < 0)
+		return -ENOENT;
+
+	*cpu = max_prio_cpu;
+	*pid = max_prio_pid;
+	*prio = max_prio;
+	return 0;
+}
+
+struct sys_info_bench {
+	struct sys_info_desc *desc;		/* NULL when benchmarking legacy */
+	struct sys_info_legacy_desc *legacy;
+	atomic64_t total_ns;
+	struct completion start;		/* the barrier all the threads start at */
+	struct completion done;
+	atomic_t nr_running;
+	bool aborted;				/* not all the threads were created */
+};
+
+/*
+ * Runs in a kthread bound to each online CPU, preemptible and with IRQs on.
+ * Each CPU publishes its own priority and then queries the maximum, as a
+ * context switch does.
+ */
+static int sys_info_bench_fn(void *info)
+{
+	struct sys_info_bench *bench = info;
+	s32 cpu = smp_processor_id();
+	s32 max_cpu, pid;
+	s64 prio;
+	u64 start;
+
+	wait_for_completion(&bench->start);
+	if (READ_ONCE(bench->aborted))
+		goto out;
+
+	start = ktime_get_ns();
+	for (int i = 0; i < SYS_INFO_BENCH_ITERS; i++) {
+		s64 curr_prio = (i * 7919 + cpu * 104729) & 0xffff;
+
+		if (bench->desc) {
+			sys_info_update_cpu_prio(bench->desc, cpu, cpu, curr_prio);
+			sys_info_get_max_prio_and_cpu(bench->desc, &max_cpu, &pid, &prio);
+		} else {
+			sys_info_legacy_update_cpu_prio(bench->legacy, cpu, cpu, curr_prio);
+			sys_info_legacy_get_max_prio_and_cpu(bench->legacy, &max_cpu, &pid, &prio);
+		}
+	}
+	atomic64_add(ktime_get_ns() - start, &bench->total_ns);
+out:
+	if (atomic_dec_and_test(&bench->nr_running))
+		complete(&bench->done);
+	return 0;
+}
+
+/*
+ * Returns the average time of an update and a query in ns, or a negative errno.
+ */
+static s64 sys_info_bench_run(bool legacy)
+{
+	struct sys_info_bench bench = {};
+	struct task_struct *thread;
+	u32 nr_cpus = 0;
+	s64 err = 0;
+	s32 cpu;
+
+	if (legacy) {
+		bench.legacy = kzalloc(sizeof(*bench.legacy), GFP_KERNEL);
+		if (!bench.legacy)
+			return -ENOMEM;
+		raw_spin_lock_init(&bench.legacy->lock);
+		for (int i = 0; i < SYS_INFO_LEGACY_MAX_NR_CPUS; i++)
+			bench.legacy->cpus[i].curr_prio = -1;
+	} else {
+		bench.desc = kzalloc(sizeof(*bench.desc), GFP_KERNEL);
+		if (!bench.desc)
+			return -ENOMEM;
+		if (sys_info_desc_init(bench.desc)) {
+			kfree(bench.desc);
+			return -ENOMEM;
+		}
+	}
+
+	init_completion(&bench.start);
+	init_completion(&bench.done);
+	atomic_set(&bench.nr_running, 0);
+
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		thread = kthread_create_on_cpu(sys_info_bench_fn, &bench, cpu, "sys_info_bench/%u");
+		if (IS_ERR(thread)) {
+			bench.aborted = true;
+			err = PTR_ERR(thread);
+			break;
+		}
+		atomic_inc(&bench.nr_running);
+		nr_cpus++;
+		wake_up_process(thread);
+	}
+	complete_all(&bench.start);
+	if (nr_cpus)
+		wait_for_completion(&bench.done);
+	cpus_read_unlock();
+
+	if (bench.desc)
+		sys_info_desc_destroy(bench.desc);
+	kfree(bench.desc);
+	kfree(bench.legacy);
+
+	if (err)
+		return err;
+	return div64_u64(atomic64_read(&bench.total_ns), (u64)nr_cpus * SYS_INFO_BENCH_ITERS);
+}
+#endif /* DAG_BPF_BENCH */
+
+// MARK: federated
+/*
+ * Federated scheduling: a heavy DAG task, whose volume C exceeds its relative
+ * deadline D, gets ceil((C - L) / (D - L)) dedicated cores, where L is its
+ * critical path. The light DAG tasks share the cores left over.
+ */
+
+/*
+ * Returns the critical path of @dag_task, recomputing it if it's stale.
+ */
+static s64 bpf_dag_task_critical_path(struct bpf_dag_task *dag_task)
+{
+	unsigned long flags;
+	s64 critical_path;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	if (!bpf_dag_task_build_csr(dag_task))
+		bpf_dag_task_refresh_critical_path(dag_task);
+	critical_path = dag_task->critical_path;
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	return critical_path;
+}
+
+/*
+ * Returns the number of dedicated cores a DAG task with @volume (C),
+ * @critical_path (L) and @deadline (D) needs, 0 if it's light, or -EINVAL if
+ * it can't meet its deadline even with unlimited cores (D <= L).
+ */
+static s64 federated_nr_cores(s64 volume, s64 critical_path, s64 deadline)
+{
+	if (volume <= deadline)
+		return 0;
+
+	if (deadline <= critical_path)
+		return -EINVAL;
+
+	return min_t(s64, div64_s64(volume - critical_path + deadline - critical_path - 1,
+				    deadline - critical_path), nr_cpu_ids);
+}
+
+/*
+ * Returns the next online CPU from the leaf *@leaf of sys_info on, and
+ * advances *@leaf past it, or returns -1 if there is none. The leaves are
+ * sorted by topology, so consecutive CPUs tend to share an LLC.
+ */
+static s32 federated_next_cpu(u32 *leaf)
+{
+	while (*leaf < sys_info_desc.nr_cpus) {
+		u32 cpu = sys_info_desc.leaf_cpu[(*leaf)++];
+
+		if (cpu_online(cpu))
+			return cpu;
+	}
+	return -1;
+}
+
+// MARK: kfuncs
+__bpf_kfunc_start_defs();
+
+/**
+ * msg:
+ *
+ * return value: dag_task id if succeeded, otherwise -1.
+ */
+__bpf_kfunc struct bpf_dag_task *bpf_dag_task_alloc(u32 src_node_tid,
+						    s64 src_node_weight,
+						    s64 relative_deadline,
+						    s64 period)
+{
+	dag_verbose("[*] bpf_dag_task_alloc (src_node_tid=%d, src_node_weight=%lld, relative_deadline=%lld, period=%lld)\n",
+		src_node_tid, src_node_weight, relative_deadline, period);
+
+	return bpf_dag_task_create(src_node_tid, src_node_weight, relative_deadline, period);
+}
+
+/*
+ * Dumps @dag_task to the kernel log. It does nothing unless the verbose module
+ * parameter is set.
+ */
+__bpf_kfunc void bpf_dag_task_dump(struct bpf_dag_task *dag_task)
+{
+	if (!READ_ONCE(verbose))
+		return;
+
+	pr_info("[*] bpf_graph_dump\n");
+
+	pr_info("  id: %d\n", dag_task->id);
+
+	pr_info("  nr_nodes: %u\n", dag_task->nr_nodes);
+	for (int i = 0; i < dag_task->nr_nodes; i++) {
+		pr_info("  node[%d]: tid=%d, weight=%lld, prio=%lld\n",
+			i,
+			dag_task->nodes[i].tid,
+			dag_task->weight[i],
+			dag_task->prio[i]);
+	}
+
+	pr_info("  nr_edges: %u\n", dag_task->nr_edges);
+	for (int i = 0; dag_task->edges && i < dag_task->nr_edges; i++) {
+		pr_info("  edge[%d]: %d --> %d\n",
+			i, dag_task->edges[i].from, dag_task->edges[i].to);
+	}
+
+	if (!bpf_dag_task_build_csr(dag_task)) {
+		for (int i = 0; i < dag_task->nr_nodes; i++) {
+			for (u32 j = dag_task->out_offs[i]; j < dag_task->out_offs[i + 1]; j++) {
+				pr_info("  outs: %d --> %d\n", i, dag_task->outs[j]);
+			}
+		}
+
+		for (int i = 0; i < dag_task->nr_nodes; i++) {
+			for (u32 j = dag_task->in_offs[i]; j < dag_task->in_offs[i + 1]; j++) {
+				pr_info("  ins: %d <-- %d\n", i, dag_task->ins[j]);
+			}
+		}
+	}
+
+	pr_info("relative_deadline: %lld", dag_task->relative_deadline);
+	pr_info("deadline: %lld", dag_task->deadline);
+	pr_info("period: %lld", dag_task->period);
+	pr_info("committed: %d", dag_task->committed);
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @tid: Thread id of the node.
+ * @weight: The weight of the node.
+ *
+ * @retval: -1 if it was failed, otherwise returns node_id.
+ */
+__bpf_kfunc s32 bpf_dag_task_add_node(struct bpf_dag_task *dag_task,
+				      u32 tid, s64 weight)
+{
+	return __bpf_dag_task_add_node(dag_task, tid, weight);
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @from:
+ * @to:
+ *
+ * @retval: -1 if it was failed, otherwise returns edge_id.
+ */
+__bpf_kfunc s32 bpf_dag_task_add_edge(struct bpf_dag_task *dag_task, u32 from, u32 to)
+{
+	return __bpf_dag_task_add_edge(dag_task, from, to);
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @nr_nodes: The number of nodes the DAG task will have.
+ * @nr_edges: The number of edges the DAG task will have.
+ *
+ * Sizes the storage of @dag_task up front so that adding nodes and edges
+ * doesn't reallocate it. Calling this is optional.
+ *
+ * @retval: 0 if succeeded, otherwise a negative errno.
+ */
+__bpf_kfunc s32 bpf_dag_task_reserve(struct bpf_dag_task *dag_task, u32 nr_nodes, u32 nr_edges)
+{
+	s32 err;
+
+	if (dag_task->committed)
+		return -EPERM;
+
+	err = bpf_dag_task_reserve_nodes(dag_task, nr_nodes);
+	if (err)
+		return err;
+
+	return bpf_dag_task_reserve_edges(dag_task, nr_edges);
+}
+
+/**
+ * @dag_task: referenced kptr
+ *
+ * Checks that @dag_task is a well-formed DAG (connected, sorted in topological
+ * order, no duplicate edges, sane degrees) and freezes its shape. After this,
+ * bpf_dag_task_add_node() and bpf_dag_task_add_edge() fail, and the graph is
+ * repacked into a read-optimized layout.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @dag_task isn't well-formed,
+ *          -EALREADY if it has already been committed, or -ENOMEM.
+ */
+__bpf_kfunc s32 bpf_dag_task_commit(struct bpf_dag_task *dag_task)
+{
+	unsigned long flags;
+	s32 err;
+
+	if (dag_task->committed)
+		return -EALREADY;
+
+	err = bpf_dag_task_build_csr(dag_task);
+	if (err)
+		return err;
+
+	if (!bpf_dag_task_is_well_formed(dag_task) ||
+	    !bpf_dag_task_is_connected(dag_task)) {
+		pr_err("DAG task (%d) isn't well-formed.", dag_task->id);
+		return -EINVAL;
+	}
+
+	err = bpf_dag_task_freeze(dag_task);
+	if (err)
+		return err;
+
+	// publishes C and an up-to-date L to bpf_dag_task_federated_assign() along with committed
+	spin_lock_irqsave(&dag_task->lock, flags);
+	bpf_dag_task_refresh_critical_path(dag_task);
+	dag_task->committed = true;
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	DAG_BPF_DEBUG_CHECK(bpf_dag_task_is_well_formed(dag_task));
+
+	return 0;
+}
+
+/**
+ * @graph: A DAG task packed by userspace, e.g. a map value: the header is
+ *         followed by struct bpf_dag_bulk_node nodes[graph->nr_nodes] and
+ *         struct edge_info edges[graph->nr_edges]. nodes[0] is the source
+ *         node, and the edges are pairs of node ids.
+ * @graph__sz: The size of @graph in bytes.
+ *
+ * Builds and commits the whole DAG task in one call, sizing its storage up
+ * front, so it costs O(nr_nodes + nr_edges) without any reallocation.
+ *
+ * @retval: The committed DAG task, or NULL if @graph is malformed, the DAG
+ *          task isn't well-formed, or it can't be allocated.
+ */
+__bpf_kfunc struct bpf_dag_task *bpf_dag_task_alloc_bulk(struct bpf_dag_bulk_graph *graph,
+							 u32 graph__sz)
+{
+	const struct bpf_dag_bulk_node *nodes;
+	const struct edge_info *edges;
+	struct bpf_dag_task *dag_task;
+	u32 nr_nodes, nr_edges;
+	s32 err;
+
+	if (graph__sz < sizeof(*graph))
+		return NULL;
+
+	// the graph lives in memory shared with BPF, so read its shape once
+	nr_nodes = READ_ONCE(graph->nr_nodes);
+	nr_edges = READ_ONCE(graph->nr_edges);
+	if (nr_nodes == 0 || nr_nodes > DAG_TASK_MAX_NODES || nr_edges > DAG_TASK_MAX_EDGES ||
+	    sizeof(*graph) + nr_nodes * sizeof(*nodes) + nr_edges * sizeof(*edges) > graph__sz) {
+		pr_err("bpf_dag_task_alloc_bulk: Malformed graph (nr_nodes=%u, nr_edges=%u, size=%u)",
+		       nr_nodes, nr_edges, graph__sz);
+		return NULL;
+	}
+	nodes = (void *)(graph + 1);
+	edges = (void *)(nodes + nr_nodes);
+
+	dag_task = bpf_dag_task_create(nodes[0].tid, nodes[0].weight,
+				       graph->relative_deadline, graph->period);
+	if (!dag_task)
+		return NULL;
+
+	err = bpf_dag_task_reserve(dag_task, nr_nodes, nr_edges);
+	if (err) {
+		pr_err("bpf_dag_task_alloc_bulk: Failed to reserve the storage (%d).", err);
+		goto err;
+	}
+
+	for (u32 i = 1; i < nr_nodes; i++) {
+		if (__bpf_dag_task_add_node(dag_task, nodes[i].tid, nodes[i].weight) < 0)
+			goto err;
+	}
+
+	for (u32 i = 0; i < nr_edges; i++) {
+		u32 from = READ_ONCE(edges[i].from), to = READ_ONCE(edges[i].to);
+
+		if (from >= nr_nodes || to >= nr_nodes) {
+			pr_err("bpf_dag_task_alloc_bulk: Edge (%u -> %u) is out of range.", from, to);
+			goto err;
+		}
+		if (bpf_dag_task_add_edge_by_id(dag_task, from, to) < 0)
+			goto err;
+	}
+
+	err = bpf_dag_task_commit(dag_task);
+	if (err)
+		goto err;
+
+	return dag_task;
+
+err:
+	bpf_dag_task_manager_remove(dag_task);
+	return NULL;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @tid: Thread id of the node.
+ *
+ * @retval: -1 if there is no node whose tid is @tid, otherwise returns node_id.
+ */
+__bpf_kfunc s32 bpf_dag_task_get_node_id(struct bpf_dag_task *dag_task, u32 tid)
+{
+	return get_node_id(dag_task, tid);
+}
+
+__bpf_kfunc s64 bpf_dag_task_get_weight(struct bpf_dag_task *dag_task, u32 node_id)
+{
+	if (node_id < dag_task->nr_nodes) {
+		return dag_task->weight[node_id];
+	} else {
+		return -1;
+	}
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ * @weight: The new weight of the node.
+ *
+ * If the priorities have already been computed by bpf_dag_task_culc_HELT_prio()
+ * or bpf_dag_task_culc_HLBS_prio(), they are updated incrementally, so they
+ * always reflect the current weights.
+ *
+ * @retval: -1 if it was failed, otherwise 0.
+ */
+__bpf_kfunc s32 bpf_dag_task_set_weight(struct bpf_dag_task *dag_task, u32 node_id, s64 weight)
+{
+	unsigned long flags;
+	u32 nr_heap = 0, nr_changed = 0;
+
+	if (node_id >= dag_task->nr_nodes)
+		return -1;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	if (dag_task->weight[node_id] == weight) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		return 0;
+	}
+
+	dag_task->volume += weight - dag_task->weight[node_id];
+	dag_task->weight[node_id] = weight;
+	dag_task->slack_valid = false;
+	dag_task->critical_path_stale = true;
+	bpf_dag_task_refresh_critical_path(dag_task);
+	if (dag_task->prio_policy != BPF_DAG_PRIO_NONE) {
+		bpf_dag_task_queue_node(dag_task, &nr_heap, node_id);
+		nr_changed = bpf_dag_task_propagate_prio(dag_task, nr_heap);
 	}
+	spin_unlock_irqrestore(&dag_task->lock, flags);
 
-	edge_id = dag_task->nr_edges;
-	dag_task->nr_edges++;
+	if (nr_changed)
+		dag_sched_call(prio_recompute, dag_task, nr_changed);
 
-	dag_task->edges[edge_id].from = from;
-	dag_task->edges[edge_id].to = to;
+	return 0;
+}
 
-	s32 nr_outs = dag_task->nodes[from].nr_outs;
-	dag_task->nodes[from].outs[nr_outs] = to;
-	dag_task->nodes[from].nr_outs++;
+/**
+ * @dag_task: referenced kptr
+ * @updates: An array of (node_id, weight) pairs, e.g. a map value.
+ * @updates__sz: The size of @updates in bytes.
+ *
+ * Applies all the weights, then updates the priorities computed by
+ * bpf_dag_task_culc_HELT_prio() or bpf_dag_task_culc_HLBS_prio() in a single
+ * pass. Nothing is applied if any node_id is out of range.
+ *
+ * @updates is validated in a first pass and applied in a second one, without
+ * copying it. It may be changed concurrently, e.g. by userspace through mmap,
+ * so every element is loaded once per pass, and an update whose node_id went
+ * out of range after the first pass is skipped.
+ *
+ * @retval: The number of nodes whose rank (HELT) or latest start time (HLBS)
+ *          changed. The priorities of other nodes may change along with them.
+ *          0 if no priorities have been computed yet, or -EINVAL.
+ */
+__bpf_kfunc s32 bpf_dag_task_set_weights(struct bpf_dag_task *dag_task,
+					 struct bpf_dag_weight_update *updates,
+					 u32 updates__sz)
+{
+	u32 nr_updates = updates__sz / sizeof(*updates);
+	u32 nr_heap = 0, nr_changed;
+	unsigned long flags;
 
-	s32 nr_ins = dag_task->nodes[to].nr_ins;
-	dag_task->nodes[to].ins[nr_ins] = from;
-	dag_task->nodes[to].nr_ins++;
+	for (u32 i = 0; i < nr_updates; i++) {
+		if (READ_ONCE(updates[i].node_id) >= dag_task->nr_nodes)
+			return -EINVAL;
+	}
 
-	WARN_ON_ONCE(!bpf_dag_task_manager_is_well_formed()); // TODO: check only when debug mode
+	spin_lock_irqsave(&dag_task->lock, flags);
+	for (u32 i = 0; i < nr_updates; i++) {
+		u32 node_id = READ_ONCE(updates[i].node_id);
+		s64 weight = READ_ONCE(updates[i].weight);
 
-	return edge_id;
+		if (node_id >= dag_task->nr_nodes || dag_task->weight[node_id] == weight)
+			continue;
+
+		dag_task->volume += weight - dag_task->weight[node_id];
+		dag_task->weight[node_id] = weight;
+		dag_task->slack_valid = false;
+		dag_task->critical_path_stale = true;
+		if (dag_task->prio_policy != BPF_DAG_PRIO_NONE)
+			bpf_dag_task_queue_node(dag_task, &nr_heap, node_id);
+	}
+
+	bpf_dag_task_refresh_critical_path(dag_task);
+	nr_changed = bpf_dag_task_propagate_prio(dag_task, nr_heap);
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	if (nr_changed)
+		dag_sched_call(prio_recompute, dag_task, nr_changed);
+
+	return nr_changed;
 }
 
-static s32 bpf_dag_task_init(struct bpf_dag_task *dag_task, u32 src_node_tid, s64 src_node_weight,
-			     s64 relative_deadline, s64 period)
+__bpf_kfunc s64 bpf_dag_task_get_prio(struct bpf_dag_task *dag_task, u32 node_id)
 {
-	s32 ret;
+	if (node_id < dag_task->nr_nodes) {
+		return dag_task->prio[node_id];
+	} else {
+		return -1;
+	}
+}
 
-	dag_task->nr_nodes = 0;
-	dag_task->nr_edges = 0;
+__bpf_kfunc void bpf_dag_task_free(struct bpf_dag_task *dag_task)
+{
+	dag_verbose("[*] bpf_dag_task_free\n");
 
-	dag_task->relative_deadline = relative_deadline;
-	dag_task->deadline = -1;
-	dag_task->period = period;
+	bpf_dag_task_manager_remove(dag_task);
+}
+
+__bpf_kfunc void bpf_dag_task_culc_HELT_prio(struct bpf_dag_task *dag_task)
+{
+	u64 now = ktime_get_boot_fast_ns();
+	unsigned long flags;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	dag_task->deadline = now + dag_task->relative_deadline;
+
+	if (dag_task->nr_nodes == 0) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		return;
+	}
+
+	if (bpf_dag_task_build_csr(dag_task)) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		pr_err("Failed to build the adjacency of DAG task (%d)", dag_task->id);
+		return;
+	}
 
 	/*
-	 * Adds a source node. The node id of the source node is always 0.
+	 * rank means the rank defined in HELT algorithm.
+	 * In HELT, a higher rank means a higher priority.
 	 */
-	ret = __bpf_dag_task_add_node(dag_task, src_node_tid, src_node_weight);
-	WARN_ON(ret != 0);
-	WARN_ON(dag_task->nr_nodes != 1);
-	WARN_ON(dag_task->nr_edges != 0);
+	for (s32 i = dag_task->nr_nodes - 1; i >= 0; i--)
+		dag_task->rank[i] = HELT_rank_of(dag_task, i);
 
-	WARN_ON_ONCE(!bpf_dag_task_manager_is_well_formed()); // TODO: check only when debug mode
+	dag_task->prio_policy = BPF_DAG_PRIO_HELT; // selects the order of sort_node_by_rank()
+	sort_node_by_rank(dag_task);
+	assign_prio(dag_task, 0, dag_task->nr_nodes - 1);
+	spin_unlock_irqrestore(&dag_task->lock, flags);
 
-	return 0;
+	dag_sched_call(prio_recompute, dag_task, dag_task->nr_nodes);
 }
 
-static void sort_node_by_prio(struct bpf_dag_task *dag_task)
+__bpf_kfunc void bpf_dag_task_culc_HLBS_prio(struct bpf_dag_task *dag_task)
 {
-	u32 tmp;
-	u32 *buf = dag_task->buf;
+	u64 now = ktime_get_boot_fast_ns();
+	unsigned long flags;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	dag_task->deadline = now + dag_task->relative_deadline;
+
+	if (dag_task->nr_nodes == 0) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		return;
+	}
+
+	if (bpf_dag_task_build_csr(dag_task)) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		pr_err("Failed to build the adjacency of DAG task (%d)", dag_task->id);
+		return;
+	}
 
 	/*
-	 * Init dag_task->buf
+	 * rank indicates the deadline by which the node must begin execution.
+	 * The rank in prio is the position in the order of the exact latest
+	 * start times, with ties broken by the node id, i.e. in topological order.
 	 */
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		buf[i] = i;
+	for (s32 i = dag_task->nr_nodes - 1; i >= 0; i--)
+		dag_task->rank[i] = HLBS_lst_of(dag_task, i);
+
+	dag_task->prio_policy = BPF_DAG_PRIO_HLBS; // selects the order of sort_node_by_rank()
+	sort_node_by_rank(dag_task);
+	assign_prio(dag_task, 0, dag_task->nr_nodes - 1);
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	dag_sched_call(prio_recompute, dag_task, dag_task->nr_nodes);
+}
+
+/**
+ * @dag_task: referenced kptr
+ *
+ * Computes the earliest start, the latest start and the slack of every node
+ * of @dag_task relative to the release of a job, in O(nr_nodes + nr_edges).
+ * Read them with bpf_dag_task_get_slack(). Call this again after changing
+ * weights, e.g. with bpf_dag_task_node_stop().
+ *
+ * @retval: 0 if succeeded, otherwise a negative errno.
+ */
+__bpf_kfunc s32 bpf_dag_task_culc_slack(struct bpf_dag_task *dag_task)
+{
+	unsigned long flags;
+	s32 err;
+
+	if (dag_task->nr_nodes == 0)
+		return -EINVAL;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	err = bpf_dag_task_build_csr(dag_task);
+	if (!err)
+		bpf_dag_task_culc_start_times(dag_task);
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	return err;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ * @slack: Filled with the start times and the slack of the node. Add the
+ *         release time of a job to get absolute times.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @node_id is out of range, or -ENODATA
+ *          if bpf_dag_task_culc_slack() hasn't been called since the last
+ *          change of the weights or the graph.
+ */
+__bpf_kfunc s32 bpf_dag_task_get_slack(struct bpf_dag_task *dag_task, u32 node_id,
+				       struct bpf_dag_node_slack *slack)
+{
+	if (node_id >= dag_task->nr_nodes)
+		return -EINVAL;
+
+	if (!dag_task->slack_valid)
+		return -ENODATA;
+
+	slack->earliest_start = dag_task->earliest_start[node_id];
+	slack->latest_start = dag_task->latest_start[node_id];
+	slack->slack = slack->latest_start - slack->earliest_start;
+	return 0;
+}
+
+/**
+ * @dag_task: referenced kptr
+ *
+ * Releases a new job instance of @dag_task now. The job gets its own absolute
+ * deadline and a snapshot of the priorities of the nodes, so the jobs that
+ * are still running keep theirs. Weight changes apply to the jobs released
+ * after them.
+ *
+ * @dag_task must be committed, and its priorities must have been computed by
+ * bpf_dag_task_culc_HELT_prio() or bpf_dag_task_culc_HLBS_prio(). The snapshot
+ * is taken under the lock of @dag_task, so it's consistent even if the
+ * priorities are recomputed or the weights are changed concurrently, and
+ * concurrent releases get distinct handles. It may also run concurrently with
+ * the other job kfuncs.
+ *
+ * @retval: The job handle (> 0) if succeeded, -EINVAL if the requirements
+ *          above aren't met, or -EBUSY if DAG_TASK_MAX_JOBS jobs are active
+ *          or the slot of the oldest completed job is still in use.
+ */
+__bpf_kfunc s64 bpf_dag_task_job_release(struct bpf_dag_task *dag_task)
+{
+	struct bpf_dag_job *job;
+	unsigned long flags;
+	u64 seq;
+
+	if (!dag_task->committed)
+		return -EINVAL;
+
+	spin_lock_irqsave(&dag_task->lock, flags);
+	if (dag_task->prio_policy == BPF_DAG_PRIO_NONE) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		return -EINVAL;
 	}
 
+	seq = dag_task->last_job + 1;
+	job = &dag_task->jobs[seq % DAG_TASK_MAX_JOBS];
 	/*
-	 * TODO: More efficient sort algorithm
-	 * Insert sort
+	 * Claims the slot. The reference is held by the job until it completes.
 	 */
-	for (int i = 1; i < dag_task->nr_nodes; i++) {
-		int j = i;
+	if (atomic_cmpxchg(&job->users, 0, 1) != 0) {
+		spin_unlock_irqrestore(&dag_task->lock, flags);
+		return -EBUSY;
+	}
 
-		while (0 < j) {
-			if (dag_task->nodes[buf[j - 1]].prio < dag_task->nodes[buf[j]].prio)
-				break;
-			
-			tmp = buf[j];
-			buf[j] = buf[j - 1];
-			buf[j - 1] = tmp;
-			j--;
-		}
+	job->release = ktime_get_boot_fast_ns();
+	job->deadline = job->release + dag_task->relative_deadline;
+	bpf_dag_task_job_assign_prio(dag_task, job);
+	for (u32 i = 0; i < dag_task->nr_nodes; i++)
+		atomic_set(&job->pending[i], dag_task->in_offs[i + 1] - dag_task->in_offs[i]);
+	smp_store_release(&job->seq, seq);
+	WRITE_ONCE(dag_task->last_job, seq);
+	spin_unlock_irqrestore(&dag_task->lock, flags);
+
+	dag_sched_call(job_release, dag_task, seq);
+	for (u32 i = 0; i < dag_task->nr_nodes; i++) {
+		if (!atomic_read(&job->pending[i]))
+			dag_sched_call(node_ready, dag_task, seq, i);
 	}
 
+	return seq;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @job: A job handle returned by bpf_dag_task_job_release().
+ *
+ * @retval: 0 if succeeded, -ENOENT if @job isn't active.
+ */
+__bpf_kfunc s32 bpf_dag_task_job_complete(struct bpf_dag_task *dag_task, u64 job)
+{
+	struct bpf_dag_job *j = bpf_dag_task_get_job(dag_task, job);
+	s64 lateness;
+
+	if (!j)
+		return -ENOENT;
+
 	/*
-	 * Verify the result
+	 * Only one of the racing completions deactivates the job.
 	 */
-	for (int i = 1; i < dag_task->nr_nodes; i++) {
-		WARN_ON_ONCE(dag_task->nodes[buf[i - 1]].prio > dag_task->nodes[buf[i]].prio);
+	if (cmpxchg(&j->seq, job, 0) != job) {
+		bpf_dag_task_put_job(j);
+		return -ENOENT;
 	}
 
-	pr_info("[DEBUG] The result of sort dag_task%d", dag_task->id);
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		pr_info("node%d", buf[i]);
-	}
+	lateness = ktime_get_boot_fast_ns() - j->deadline;
+	if (lateness > 0)
+		dag_sched_call(deadline_miss, dag_task, job, lateness);
+
+	bpf_dag_task_put_job(j); // the reference of the job itself
+	bpf_dag_task_put_job(j);
+	return 0;
 }
 
-// MARK: sys_info
-/*
- * This implementation manages per-CPU information, including:
- *   - the current thread running on each CPU
- *   - its current priority
+/**
+ * @dag_task: referenced kptr
+ * @job: A job handle returned by bpf_dag_task_job_release().
+ * @node_id: A node that is ready in @job.
+ * @ready: Filled with the ids of the successors that became ready.
+ * @ready__sz: The size of @ready in bytes.
+ *
+ * Marks that node @node_id finished in @job and decrements the pending count
+ * of each of its successors, in O(out-degree). The pending counts are atomic,
+ * so nodes of the same job can complete concurrently on different CPUs, and
+ * each successor becomes ready exactly once. It may also race with
+ * bpf_dag_task_job_release() and bpf_dag_task_job_complete(): it holds a
+ * reference to the slot of @job, so the slot isn't reused under it, and it
+ * returns -ENOENT once @job has completed. The node_ready callbacks may run
+ * after @job has completed, and a node completed by a racing
+ * bpf_dag_task_job_complete() isn't rolled back.
+ *
+ * @retval: The number of successors that became ready, which may exceed the
+ *          capacity of @ready (only the first ones are stored then). -ENOENT
+ *          if @job isn't active, -EINVAL if @node_id is out of range, or
+ *          -EBUSY if the node isn't ready or has already finished.
  */
-#define MAX_NR_CPUS 512 /* TODO: hard coding */
+__bpf_kfunc s32 bpf_dag_task_node_complete(struct bpf_dag_task *dag_task, u64 job, u32 node_id,
+					   u32 *ready, u32 ready__sz)
+{
+	struct bpf_dag_job *j = bpf_dag_task_get_job(dag_task, job);
+	u32 max_nr_ready = ready__sz / sizeof(*ready);
+	s32 nr_ready = 0;
 
-struct cpu_info {
-	s32 curr_pid;
-	s64 curr_prio;
-};
+	if (!j)
+		return -ENOENT;
 
-struct sys_info_desc {
-	raw_spinlock_t lock;
-	struct cpu_info cpus[MAX_NR_CPUS];
-	s64 max_prio;
-	s32 max_prio_cpu;
-};
+	if (node_id >= dag_task->nr_nodes) {
+		bpf_dag_task_put_job(j);
+		return -EINVAL;
+	}
 
-struct sys_info_desc sys_info_desc;
+	if (atomic_cmpxchg(&j->pending[node_id], 0, -1) != 0) {
+		bpf_dag_task_put_job(j);
+		return -EBUSY;
+	}
+
+	dag_sched_call(node_complete, dag_task, job, node_id);
+
+	for (u32 k = dag_task->out_offs[node_id]; k < dag_task->out_offs[node_id + 1]; k++) {
+		u32 succ = dag_task->outs[k];
+
+		if (!atomic_dec_and_test(&j->pending[succ]))
+			continue;
+
+		if (nr_ready < max_nr_ready)
+			ready[nr_ready] = succ;
+		nr_ready++;
+		dag_sched_call(node_ready, dag_task, job, succ);
+	}
+
+	bpf_dag_task_put_job(j);
+	return nr_ready;
+}
 
-static __init void bpf_sys_info_init(void)
+/**
+ * @dag_task: referenced kptr
+ * @job: A job handle returned by bpf_dag_task_job_release().
+ * @node_id:
+ *
+ * @retval: The number of unfinished predecessors of the node in @job (0 if it
+ *          is ready), -1 if it has finished, -ENOENT if @job isn't active, or
+ *          -EINVAL if @node_id is out of range.
+ */
+__bpf_kfunc s32 bpf_dag_task_job_get_pending(struct bpf_dag_task *dag_task, u64 job, u32 node_id)
 {
-	raw_spin_lock_init(&sys_info_desc.lock);
+	struct bpf_dag_job *j = bpf_dag_task_get_job(dag_task, job);
+	s32 pending;
+
+	if (!j)
+		return -ENOENT;
 
-	for (int cpu = 0; cpu < nr_cpu_ids; cpu++) {
-		WARN_ON_ONCE(!cpu_possible(cpu));
-		sys_info_desc.cpus[cpu].curr_pid = -1;
-		sys_info_desc.cpus[cpu].curr_prio = -1;
+	if (node_id >= dag_task->nr_nodes) {
+		bpf_dag_task_put_job(j);
+		return -EINVAL;
 	}
-	sys_info_desc.max_prio = -1;
-	sys_info_desc.max_prio_cpu = -1;
+
+	pending = atomic_read(&j->pending[node_id]);
+	bpf_dag_task_put_job(j);
+	return pending;
 }
 
-static s32 __bpf_sys_info_update_cpu_prio(s32 cpu, s32 pid, s64 prio)
+/**
+ * @dag_task: referenced kptr
+ * @job: A job handle returned by bpf_dag_task_job_release().
+ * @node_id:
+ *
+ * @retval: The priority key of the node in @job, or -1 if @job isn't active
+ *          or @node_id is out of range.
+ */
+__bpf_kfunc s64 bpf_dag_task_job_get_prio(struct bpf_dag_task *dag_task, u64 job, u32 node_id)
 {
-	unsigned long flags;
+	struct bpf_dag_job *j;
+	s64 prio;
+
+	if (node_id >= dag_task->nr_nodes)
+		return -1;
+
+	j = bpf_dag_task_get_job(dag_task, job);
+	if (!j)
+		return -1;
+
+	prio = j->prio[node_id];
+	bpf_dag_task_put_job(j);
+	return prio;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @job: A job handle returned by bpf_dag_task_job_release().
+ *
+ * @retval: The absolute deadline of @job, or -1 if @job isn't active.
+ */
+__bpf_kfunc s64 bpf_dag_task_job_get_deadline(struct bpf_dag_task *dag_task, u64 job)
+{
+	struct bpf_dag_job *j = bpf_dag_task_get_job(dag_task, job);
+	s64 deadline;
+
+	if (!j)
+		return -1;
+
+	deadline = j->deadline;
+	bpf_dag_task_put_job(j);
+	return deadline;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ *
+ * Marks that node @node_id starts to run for a job, e.g. when its thread is
+ * woken up for the job. Call bpf_dag_task_node_stop() when the node finishes
+ * the job to feed the CPU time it consumed in between into its estimate.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @dag_task isn't committed or @node_id is
+ *          out of range, or -ESRCH if the thread of the node doesn't exist.
+ */
+__bpf_kfunc s32 bpf_dag_task_node_start(struct bpf_dag_task *dag_task, u32 node_id)
+{
+	s64 runtime;
 
-	if (!(0 <= cpu && cpu < MAX_NR_CPUS))
+	if (!dag_task->committed || node_id >= dag_task->nr_nodes)
 		return -EINVAL;
- 
-	raw_spin_lock_irqsave(&sys_info_desc.lock, flags);
-	sys_info_desc.cpus[cpu].curr_pid = pid;
-	sys_info_desc.cpus[cpu].curr_prio = prio;
-	raw_spin_unlock_irqrestore(&sys_info_desc.lock, flags);
-	
+
+	runtime = dag_task_exec_runtime(dag_task->nodes[node_id].tid);
+	if (runtime < 0)
+		return runtime;
+
+	WRITE_ONCE(dag_task->exec_start[node_id], runtime);
 	return 0;
 }
 
-static s32 __bpf_sys_info_get_max_prio_and_cpu(s32 *cpu, s32 *pid, s64 *prio)
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ * @flags: BPF_DAG_EST_SET_WEIGHT_EWMA or BPF_DAG_EST_SET_WEIGHT_PCTL to write
+ *         the updated estimate back into the weight of the node, which
+ *         updates the priorities like bpf_dag_task_set_weight(). 0 only
+ *         updates the estimate.
+ *
+ * Marks that node @node_id finished its job, and updates the runtime estimate
+ * of the node read by bpf_dag_task_get_runtime_est().
+ *
+ * @retval: The CPU time consumed by the node since bpf_dag_task_node_start()
+ *          in ns, -EINVAL if the arguments are invalid, -ENOENT if the node
+ *          hasn't been started, or -ESRCH if its thread doesn't exist.
+ */
+__bpf_kfunc s64 bpf_dag_task_node_stop(struct bpf_dag_task *dag_task, u32 node_id, u32 flags)
 {
-	unsigned long flags;
-	s64 max_prio = -1;
-	s32 max_prio_cpu = -1;
-	s32 max_prio_pid = -1;
-	
-	raw_spin_lock_irqsave(&sys_info_desc.lock, flags);
-	for (int cpu = 0; cpu < nr_cpu_ids; cpu++) {
-		struct cpu_info *cpu_info = &sys_info_desc.cpus[cpu];
+	struct bpf_dag_runtime_est *est;
+	s64 start, runtime;
 
-		if (cpu_info->curr_prio < 0)
-			continue;
+	if (!dag_task->committed || node_id >= dag_task->nr_nodes)
+		return -EINVAL;
 
-		if (max_prio < cpu_info->curr_prio) {
-			WARN_ON_ONCE(cpu_info->curr_pid < 0);
-			WARN_ON_ONCE(cpu_info->curr_prio < 0);
-			max_prio = cpu_info->curr_prio;
-			max_prio_cpu = cpu;
-			max_prio_pid = cpu_info->curr_pid;
-		}
-	}
-	raw_spin_unlock_irqrestore(&sys_info_desc.lock, flags);
+	if (flags & ~(BPF_DAG_EST_SET_WEIGHT_EWMA | BPF_DAG_EST_SET_WEIGHT_PCTL) ||
+	    flags == (BPF_DAG_EST_SET_WEIGHT_EWMA | BPF_DAG_EST_SET_WEIGHT_PCTL))
+		return -EINVAL;
+
+	start = xchg(&dag_task->exec_start[node_id], -1);
+	if (start < 0)
+		return -ENOENT;
+
+	runtime = dag_task_exec_runtime(dag_task->nodes[node_id].tid);
+	if (runtime < 0)
+		return runtime;
+	runtime -= start;
+
+	est = &dag_task->est[node_id];
+	dag_runtime_est_update(est, runtime);
+
+	if (flags & BPF_DAG_EST_SET_WEIGHT_EWMA)
+		bpf_dag_task_set_weight(dag_task, node_id, est->ewma);
+	else if (flags & BPF_DAG_EST_SET_WEIGHT_PCTL)
+		bpf_dag_task_set_weight(dag_task, node_id, est->pctl);
+
+	return runtime;
+}
+
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ * @est: Filled with the runtime estimate of the node.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @dag_task isn't committed or @node_id is
+ *          out of range.
+ */
+__bpf_kfunc s32 bpf_dag_task_get_runtime_est(struct bpf_dag_task *dag_task, u32 node_id,
+					     struct bpf_dag_runtime_est *est)
+{
+	if (!dag_task->committed || node_id >= dag_task->nr_nodes)
+		return -EINVAL;
+
+	*est = dag_task->est[node_id];
+	return 0;
+}
+
+/**
+ * @time_ns: A deadline or a latest start time.
+ * @dag_id: The id of the DAG task. Only the lower DAG_PRIO_DAG_BITS bits are used.
+ * @rank: The rank within the DAG task. Only the lower DAG_PRIO_RANK_BITS bits are used.
+ *
+ * @retval: The priority key in the encoding returned by bpf_dag_task_get_prio()
+ *          and expected by the sys_info kfuncs. A smaller key is more urgent.
+ */
+__bpf_kfunc s64 bpf_dag_prio_encode(s64 time_ns, u32 dag_id, u32 rank)
+{
+	return dag_prio_encode(time_ns, dag_id, rank);
+}
 
-	if (max_prio_cpu < 0) {
-		return -ENOENT;
-	} else {
-		*cpu = max_prio_cpu;
-		*pid = max_prio_pid;
-		*prio = max_prio;
-		return 0;
-	}
+/**
+ * @prio: A priority key.
+ *
+ * @retval: The time of @prio in ns, rounded down to 2^DAG_PRIO_TIME_SHIFT ns.
+ */
+__bpf_kfunc s64 bpf_dag_prio_decode_time(s64 prio)
+{
+	return (prio >> DAG_PRIO_TIME_LSB) << DAG_PRIO_TIME_SHIFT;
 }
 
-// MARK: kfuncs
-__bpf_kfunc_start_defs();
+/**
+ * @prio: A priority key.
+ *
+ * @retval: The id of the DAG task of @prio.
+ */
+__bpf_kfunc u32 bpf_dag_prio_decode_dag(s64 prio)
+{
+	return (prio >> DAG_PRIO_RANK_BITS) & DAG_PRIO_DAG_MASK;
+}
 
-__bpf_kfunc void bpf_dag_task_free(struct bpf_dag_task *dag_task);
+/**
+ * @prio: A priority key.
+ *
+ * @retval: The rank of @prio.
+ */
+__bpf_kfunc u32 bpf_dag_prio_decode_rank(s64 prio)
+{
+	return prio & DAG_PRIO_RANK_MASK;
+}
 
 /**
- * msg:
+ * @dag_task: referenced kptr
  *
- * return value: dag_task id if succeeded, otherwise -1.
+ * @retval: The sum of the weights of the nodes (C).
  */
-__bpf_kfunc struct bpf_dag_task *bpf_dag_task_alloc(u32 src_node_tid,
-						    s64 src_node_weight,
-						    s64 relative_deadline,
-						    s64 period)
+__bpf_kfunc s64 bpf_dag_task_get_volume(struct bpf_dag_task *dag_task)
 {
-	s32 err;
-	struct bpf_dag_task *dag_task = NULL;
+	return dag_task->volume;
+}
 
-	pr_info("[*] bpf_dag_task_alloc (src_node_tid=%d, src_node_weight=%lld, relative_deadline=%lld, period=%lld)\n",
-		src_node_tid, src_node_weight, relative_deadline, period);
+/**
+ * @dag_task: referenced kptr
+ *
+ * @retval: The length of the longest path of the DAG task (L).
+ */
+__bpf_kfunc s64 bpf_dag_task_get_critical_path(struct bpf_dag_task *dag_task)
+{
+	return bpf_dag_task_critical_path(dag_task);
+}
 
-	if (bpf_dag_task_manager.nr_dag_tasks >= BPF_DAG_TASK_LIMIT) {
-		pr_err("There is no slots for a DAG task.");
-		return NULL;
-	}
+/**
+ * Assigns cores to all the committed DAG tasks by federated scheduling. Each
+ * heavy DAG task gets its dedicated cores, taken from the online CPUs in
+ * topology order so that they share LLCs where possible, and the light DAG
+ * tasks share the rest. Read the result with bpf_dag_task_get_cpumask().
+ *
+ * C and L are read from a snapshot taken under the lock of each DAG task, so
+ * its owner may change the weights concurrently. CPU hotplug is held off while
+ * the online CPUs are counted and picked.
+ *
+ * @retval: The number of heavy DAG tasks, -EINVAL if a heavy DAG task can't
+ *          meet its deadline (D <= L), -ENOSPC if there aren't enough online
+ *          CPUs, or -EBUSY if a CPU is being hotplugged. The previous
+ *          assignment is kept on failure.
+ */
+__bpf_kfunc s32 bpf_dag_task_federated_assign(void)
+{
+	struct bpf_dag_task *dag_task;
+	unsigned long flags;
+	u32 nr_online = 0, nr_needed = 0, nr_heavy = 0, leaf = 0, shared_leaf;
+	bool has_light = false;
+	s32 ret = 0;
+	int id;
+
+	// cpus_read_lock() may sleep, and the callers may not
+	if (!cpus_read_trylock())
+		return -EBUSY;
+	spin_lock_irqsave(&bpf_dag_task_manager.lock, flags);
+
+	idr_for_each_entry(&bpf_dag_task_manager.idr, dag_task, id) {
+		unsigned long task_flags;
+		s64 volume, critical_path, nr_cores;
+		bool committed;
+
+		spin_lock_irqsave(&dag_task->lock, task_flags);
+		committed = dag_task->committed;
+		volume = dag_task->volume;
+		critical_path = dag_task->critical_path;
+		spin_unlock_irqrestore(&dag_task->lock, task_flags);
+
+		// a DAG task committed after this pass keeps its cores until the next call
+		dag_task->federated_nr_cores = -1;
+		if (!committed)
+			continue;
 
-	for (int i = 0; i < BPF_DAG_TASK_LIMIT; i++) {
-		if (!bpf_dag_task_manager.inuse[i]) {
-			dag_task = &bpf_dag_task_manager.dag_tasks[i];
-			bpf_dag_task_manager.inuse[i] = true;
-			bpf_dag_task_manager.nr_dag_tasks++;
-			break;
+		nr_cores = federated_nr_cores(volume, critical_path, dag_task->relative_deadline);
+		if (nr_cores < 0) {
+			pr_warn("DAG task (%d) can't meet its deadline with federated scheduling", dag_task->id);
+			ret = nr_cores;
+			goto unlock;
 		}
+		dag_task->federated_nr_cores = nr_cores;
+		nr_needed += nr_cores;
+		has_light |= !nr_cores;
 	}
 
-	if (!dag_task) {
-		pr_warn("Failed to allocate a DAG task.");
-		return NULL;
-	}
-
-	err = bpf_dag_task_init(dag_task, src_node_tid, src_node_weight, relative_deadline, period);
-	if (err) {
-		pr_err("Failed to init a DAG task.");
-		bpf_dag_task_free(dag_task);
-		return NULL;
+	for (u32 i = 0; i < sys_info_desc.nr_cpus; i++)
+		nr_online += cpu_online(sys_info_desc.leaf_cpu[i]);
+	if (nr_needed + has_light > nr_online) {
+		ret = -ENOSPC;
+		goto unlock;
 	}
 
-	return dag_task;
-}
-
-__bpf_kfunc void bpf_dag_task_dump(struct bpf_dag_task *dag_task)
-{
-	pr_info("[*] bpf_graph_dump\n");
-
-	pr_info("  id: %d\n", dag_task->id);
+	idr_for_each_entry(&bpf_dag_task_manager.idr, dag_task, id) {
+		if (dag_task->federated_nr_cores < 0)
+			continue;
 
-	pr_info("  nr_nodes: %u\n", dag_task->nr_nodes);
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		pr_info("  node[%d]: tid=%d, weight=%lld, prio=%lld\n",
-			i,
-			dag_task->nodes[i].tid,
-			dag_task->nodes[i].weight,
-			dag_task->nodes[i].prio);
+		dag_task->nr_cores = dag_task->federated_nr_cores;
+		cpumask_clear(dag_task->cpus);
+		// nr_online covers them, and no CPU can go offline meanwhile
+		for (u32 k = 0; k < dag_task->nr_cores; k++)
+			cpumask_set_cpu(federated_next_cpu(&leaf), dag_task->cpus);
+		nr_heavy += !!dag_task->nr_cores;
 	}
 
-	pr_info("  nr_edges: %u\n", dag_task->nr_edges);
-	for (int i = 0; i < dag_task->nr_edges; i++) {
-		pr_info("  edge[%d]: %d --> %d\n",
-			i, dag_task->edges[i].from, dag_task->edges[i].to);
-	}
+	idr_for_each_entry(&bpf_dag_task_manager.idr, dag_task, id) {
+		s32 cpu;
 
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		for (int j = 0; j < dag_task->nodes[i].nr_outs; j++) {
-			pr_info("  outs: %d --> %d\n", i, dag_task->nodes[i].outs[j]);
-		}
-	}
+		if (dag_task->federated_nr_cores != 0)
+			continue;
 
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		for (int j = 0; j < dag_task->nodes[i].nr_ins; j++) {
-			pr_info("  ins: %d <-- %d\n", i, dag_task->nodes[i].ins[j]);
-		}
+		shared_leaf = leaf;
+		while ((cpu = federated_next_cpu(&shared_leaf)) >= 0)
+			cpumask_set_cpu(cpu, dag_task->cpus);
 	}
+	ret = nr_heavy;
 
-	pr_info("relative_deadline: %lld", dag_task->relative_deadline);
-	pr_info("deadline: %lld", dag_task->deadline);
-	pr_info("period: %lld", dag_task->period);
+unlock:
+	spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+	cpus_read_unlock();
+	return ret;
 }
 
+struct bpf_cpumask; // private to kernel/bpf/cpumask.c
+
 /**
  * @dag_task: referenced kptr
- * @tid: Thread id of the node.
- * @weight: The weight of the node.
+ * @dst: A BPF cpumask created by bpf_cpumask_create(), filled with the
+ *       cores assigned to @dag_task by bpf_dag_task_federated_assign().
  *
- * @retval: -1 if it was failed, otherwise returns node_id.
+ * Only a struct bpf_cpumask is accepted, so that the kfunc can't write other
+ * trusted cpumasks such as the affinity of a task.
+ *
+ * @retval: The number of the dedicated cores (0 if @dag_task is light and
+ *          shares the cores), or -ENODATA if no cores have been assigned.
  */
-__bpf_kfunc s32 bpf_dag_task_add_node(struct bpf_dag_task *dag_task,
-				      u32 tid, s64 weight)
+__bpf_kfunc s32 bpf_dag_task_get_cpumask(struct bpf_dag_task *dag_task, struct bpf_cpumask *dst)
 {
-	return __bpf_dag_task_add_node(dag_task, tid, weight);
+	unsigned long flags;
+	s32 ret = -ENODATA;
+
+	spin_lock_irqsave(&bpf_dag_task_manager.lock, flags);
+	if (!cpumask_empty(dag_task->cpus)) {
+		/*
+		 * The cpumask is the first member of struct bpf_cpumask, as
+		 * the bpf_cpumask kfuncs of the kernel rely on.
+		 */
+		cpumask_copy((struct cpumask *)dst, dag_task->cpus);
+		ret = dag_task->nr_cores;
+	}
+	spin_unlock_irqrestore(&bpf_dag_task_manager.lock, flags);
+
+	return ret;
 }
 
 /**
+ * @cpu: The CPU whose ready queue to push to, or BPF_DAG_RQ_GLOBAL.
  * @dag_task: referenced kptr
- * @from:
- * @to:
+ * @job: A job handle returned by bpf_dag_task_job_release(), or 0 to use the
+ *       priority of the node of @dag_task itself.
+ * @node_id:
  *
- * @retval: -1 if it was failed, otherwise returns edge_id.
+ * Queues the node with its priority key in @job.
+ *
+ * @retval: 0 on success, -EINVAL if @cpu or @node_id is invalid or @dag_task
+ *          isn't committed, -ENOENT if @job isn't active, or -EBUSY if the
+ *          node is already in a ready queue.
  */
-__bpf_kfunc s32 bpf_dag_task_add_edge(struct bpf_dag_task *dag_task, u32 from, u32 to)
+__bpf_kfunc s32 bpf_dag_rq_push(s32 cpu, struct bpf_dag_task *dag_task, u64 job, u32 node_id)
 {
-	return __bpf_dag_task_add_edge(dag_task, from, to);
-}
+	struct dag_rq *rq = dag_rq_of(cpu);
+	struct bpf_dag_job *j;
+	s64 prio;
 
-__bpf_kfunc s64 bpf_dag_task_get_weight(struct bpf_dag_task *dag_task, u32 node_id)
-{
-	if (node_id < dag_task->nr_nodes) {
-		return dag_task->nodes[node_id].weight;
-	} else {
-		return -1;
-	}
-}
+	if (!rq || !dag_task->committed || node_id >= dag_task->nr_nodes)
+		return -EINVAL;
 
-__bpf_kfunc s32 bpf_dag_task_set_weight(struct bpf_dag_task *dag_task, u32 node_id, s64 weight)
-{
-	if (node_id < dag_task->nr_nodes) {
-		dag_task->nodes[node_id].weight = weight;
-		return 0;
+	if (job) {
+		j = bpf_dag_task_get_job(dag_task, job);
+		if (!j)
+			return -ENOENT;
+		prio = j->prio[node_id];
+		bpf_dag_task_put_job(j);
 	} else {
-		return -1;
+		prio = dag_task->prio[node_id];
 	}
-}
 
-__bpf_kfunc s64 bpf_dag_task_get_prio(struct bpf_dag_task *dag_task, u32 node_id)
-{
-	if (node_id < dag_task->nr_nodes) {
-		return dag_task->nodes[node_id].prio;
-	} else {
-		return -1;
-	}
+	return dag_rq_push(rq, &dag_task->rq_entries[node_id], prio, job);
 }
 
-__bpf_kfunc void bpf_dag_task_free(struct bpf_dag_task *dag_task)
+/**
+ * @dag_task: referenced kptr
+ * @node_id:
+ *
+ * Takes the node out of the ready queue holding it.
+ *
+ * @retval: 0 on success, -EINVAL if @node_id is invalid or @dag_task isn't
+ *          committed, or -ENOENT if the node isn't in any ready queue.
+ */
+__bpf_kfunc s32 bpf_dag_rq_remove(struct bpf_dag_task *dag_task, u32 node_id)
 {
-	pr_info("[*] bpf_dag_task_free\n");
+	if (!dag_task->committed || node_id >= dag_task->nr_nodes)
+		return -EINVAL;
 
-	for (int i = 0; i < BPF_DAG_TASK_LIMIT; i++) {
-		if (&bpf_dag_task_manager.dag_tasks[i] == dag_task) {
-			WARN_ON(!bpf_dag_task_manager.inuse[i]);
-			bpf_dag_task_manager.inuse[i] = false;
-			bpf_dag_task_manager.nr_dag_tasks--;
-			return;
-		}
-	}
-	WARN_ON(true); // unreachable
+	return dag_rq_remove(&dag_task->rq_entries[node_id]);
 }
 
-__bpf_kfunc void bpf_dag_task_culc_HELT_prio(struct bpf_dag_task *dag_task)
+/**
+ * @cpu: The CPU whose ready queue to pop from, or BPF_DAG_RQ_GLOBAL.
+ * @item: Filled with the node with the smallest priority key.
+ *
+ * @retval: 0 on success, -EINVAL if @cpu is invalid, or -ENOENT if the ready
+ *          queue is empty.
+ */
+__bpf_kfunc s32 bpf_dag_rq_pop_min(s32 cpu, struct bpf_dag_rq_item *item)
 {
-	u64 now = ktime_get_boot_fast_ns();
+	struct dag_rq *rq = dag_rq_of(cpu);
 
-	dag_task->deadline = now + dag_task->relative_deadline;
+	if (!rq)
+		return -EINVAL;
 
-	if (dag_task->nr_nodes == 0)
-		return;
+	return dag_rq_first_item(rq, cpu, item, true);
+}
 
-	for (s32 i = dag_task->nr_nodes - 1; i >= 0; i--) {
-		struct node_info *curr_node = &dag_task->nodes[i];
+/**
+ * @cpu: The CPU whose ready queue to peek, or BPF_DAG_RQ_GLOBAL.
+ * @item: Filled with the node with the smallest priority key, which is left
+ *        in the ready queue.
+ *
+ * @retval: 0 on success, -EINVAL if @cpu is invalid, or -ENOENT if the ready
+ *          queue is empty.
+ */
+__bpf_kfunc s32 bpf_dag_rq_peek_min(s32 cpu, struct bpf_dag_rq_item *item)
+{
+	struct dag_rq *rq = dag_rq_of(cpu);
 
-		if (curr_node->nr_outs == 0) {
-			/*
-			 * node->prio means the rank defined in HELT algorithm.
-			 */
-			curr_node->prio = curr_node->weight;
-		} else {
-			s64 tail_weight_max = 0;
-			for (int j = 0; j < curr_node->nr_outs; j++) {
-				int node_id = curr_node->outs[j];
-				struct node_info *node = &dag_task->nodes[node_id];
-				s64 tail_weight_curr = node->prio;
-				tail_weight_max = tail_weight_max < tail_weight_curr ? tail_weight_curr : tail_weight_max;
-			}
-			curr_node->prio = curr_node->weight + tail_weight_max;
-		}
-	}
+	if (!rq)
+		return -EINVAL;
 
-	sort_node_by_prio(dag_task);
-	/*
-	 * Reassign priority to compare the deadline between DAG tasks.
-	 */
-	u32 *buf = dag_task->buf;
-	for (int i = 0; i < dag_task->nr_nodes; i++) {
-		/*
-		 * The above HELT algorithm calculates the rank value and stores it in prio.
-		 * In HELT, a higher rank means a higher priority.
-		 * However, since sort_node_by_prio sorts nodes in ascending order of prio,
-		 * the order stored in buf becomes the reverse of the intended priority.
-		 * 
-		 * To fix this, we store the value obtained by subtracting the node index
-		 * from dag_task->deadline into prio. This way, when sorted in ascending order:
-		 *   - DAG tasks with earlier deadlines are prioritized,
-		 *   - and among nodes in the same DAG task, those with higher ranks are prioritized.
-		 *
-		 * TODO: If deadlines are too close between DAG tasks, priority ordering may become unstable.
-		 * We need to address this issue.
-		 */
-		dag_task->nodes[buf[i]].prio = dag_task->deadline - i;
-	}
+	return dag_rq_first_item(rq, cpu, item, false);
 }
 
-__bpf_kfunc void bpf_dag_task_culc_HLBS_prio(struct bpf_dag_task *dag_task)
+/**
+ * @cpu: The CPU stealing a node.
+ * @item: Filled with the stolen node. item->cpu is the CPU it was stolen from.
+ *
+ * Pops the most urgent node from the ready queues of the other CPUs sharing
+ * the last level cache with @cpu, or from those in the same NUMA node if they
+ * are all empty. The queues are chosen by their cached minimums without
+ * taking their locks.
+ *
+ * @retval: 0 on success, -EINVAL if @cpu is invalid, or -ENOENT if there is
+ *          nothing to steal.
+ */
+__bpf_kfunc s32 bpf_dag_rq_steal(s32 cpu, struct bpf_dag_rq_item *item)
 {
-	u64 now = ktime_get_boot_fast_ns();
+	const struct cpumask *masks[2];
 
-	dag_task->deadline = now + dag_task->relative_deadline;
+	if (cpu < 0 || !dag_rq_of(cpu))
+		return -EINVAL;
 
-	if (dag_task->nr_nodes == 0)
-		return;
+	masks[0] = sys_info_llc_mask(cpu);
+	masks[1] = cpumask_of_node(cpu_to_node(cpu));
 
-	for (s32 i = dag_task->nr_nodes - 1; i >= 0; i--) {
-		struct node_info *curr_node = &dag_task->nodes[i];
+	for (int i = 0; i < ARRAY_SIZE(masks); i++) {
+		if (i > 0 && masks[i] == masks[i - 1])
+			break;
 
-		if (curr_node->nr_outs == 0) {
-			/*
-			 * node->prio indicates the deadline by which the node must begin execution.
-			 */
-			curr_node->prio = dag_task->deadline - curr_node->weight;
-		} else {
-			s64 tail_deadline_min = S64_MAX;
-			for (int j = 0; j < curr_node->nr_outs; j++) {
-				int node_id = curr_node->outs[j];
-				struct node_info *node = &dag_task->nodes[node_id];
-				s64 tail_deadline_curr = node->prio;
-				tail_deadline_min = tail_deadline_min < tail_deadline_curr
-					? tail_deadline_min : tail_deadline_curr;
+		for (int retry = 0; retry < DAG_RQ_STEAL_RETRIES; retry++) {
+			s64 best_prio = S64_MAX;
+			s32 best = -1;
+			int sibling;
+
+			for_each_cpu(sibling, masks[i]) {
+				s64 prio = READ_ONCE(per_cpu_ptr(dag_rq_cpus, sibling)->min_prio);
+
+				if (sibling != cpu && prio < best_prio) {
+					best_prio = prio;
+					best = sibling;
+				}
 			}
-			curr_node->prio = tail_deadline_min - curr_node->weight;
+			if (best < 0)
+				break;
+
+			// the victim may have been drained since it was read
+			if (!dag_rq_first_item(per_cpu_ptr(dag_rq_cpus, best), best, item, true))
+				return 0;
 		}
 	}
+
+	return -ENOENT;
 }
 
 __bpf_kfunc void bpf_dag_task_release_dtor(void *dag_task)
 {
-	pr_info("[*] bpf_dag_task_release_dtor\n");
+	dag_verbose("[*] bpf_dag_task_release_dtor\n");
 
-	for (int i = 0; i < BPF_DAG_TASK_LIMIT; i++) {
-		if (&bpf_dag_task_manager.dag_tasks[i] == dag_task) {
-			WARN_ON(!bpf_dag_task_manager.inuse[i]);
-			bpf_dag_task_manager.inuse[i] = false;
-			bpf_dag_task_manager.nr_dag_tasks--;
-			return;
-		}
-	}
-	WARN_ON(true); // unreachable
+	bpf_dag_task_manager_remove(dag_task);
 }
 CFI_NOSEAL(bpf_dag_task_release_dtor);
 
@@ -810,21 +3856,131 @@ __bpf_kfunc s32 bpf_sys_info_get_max_prio_and_cpu(s32 *cpu, s32 *pid, s64 *prio)
 	return __bpf_sys_info_get_max_prio_and_cpu(cpu, pid, prio);
 }
 
+/**
+ * @victims: The array to be filled with the victims, e.g. a map value.
+ * @victims__sz: The size of @victims in bytes.
+ * @flags: BPF_SYS_INFO_RESERVE to reserve the returned CPUs.
+ *
+ * Returns the CPUs with the largest priorities in descending order, at most
+ * 32 at once. Reserved CPUs are skipped, and count as having the priority -1
+ * in every query until bpf_sys_info_release_cpu() or
+ * bpf_sys_info_update_cpu_prio() is called for them.
+ *
+ * @retval: The number of victims stored in @victims.
+ */
+__bpf_kfunc s32 bpf_sys_info_get_victims(struct bpf_sys_info_victim *victims, u32 victims__sz, u32 flags)
+{
+	return sys_info_get_victims(&sys_info_desc, victims, victims__sz / sizeof(*victims), flags);
+}
+
+/**
+ * @cpu: A CPU reserved by bpf_sys_info_get_victims().
+ *
+ * @retval: 0 if succeeded, -EINVAL if @cpu is invalid.
+ */
+__bpf_kfunc s32 bpf_sys_info_release_cpu(s32 cpu)
+{
+	return sys_info_release_cpu(&sys_info_desc, cpu);
+}
+
+/**
+ * @mask: The CPUs to consider, e.g. the CPUs assigned to a DAG task.
+ *
+ * Same as bpf_sys_info_get_max_prio_and_cpu(), but only considers the CPUs in @mask.
+ *
+ * @retval: 0 if succeeded, -ENOENT if no CPU in @mask has a priority.
+ */
+__bpf_kfunc s32 bpf_sys_info_get_max_prio_and_cpu_in(const struct cpumask *mask,
+						     s32 *cpu, s32 *pid, s64 *prio)
+{
+	return sys_info_get_max_prio_and_cpu_in(&sys_info_desc, mask, cpu, pid, prio);
+}
+
+/**
+ * @this_cpu:
+ *
+ * Same as bpf_sys_info_get_max_prio_and_cpu(), but only considers the CPUs
+ * sharing the last level cache with @this_cpu.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @this_cpu is invalid,
+ *          -ENOENT if no CPU in the LLC has a priority.
+ */
+__bpf_kfunc s32 bpf_sys_info_get_max_prio_and_cpu_llc(s32 this_cpu, s32 *cpu, s32 *pid, s64 *prio)
+{
+	if (!(0 <= this_cpu && this_cpu < sys_info_desc.nr_cpus))
+		return -EINVAL;
+
+	return sys_info_get_max_prio_and_cpu_in(&sys_info_desc, sys_info_llc_mask(this_cpu),
+						cpu, pid, prio);
+}
+
+/**
+ * @this_cpu:
+ *
+ * Same as bpf_sys_info_get_max_prio_and_cpu(), but only considers the CPUs
+ * in the NUMA node of @this_cpu.
+ *
+ * @retval: 0 if succeeded, -EINVAL if @this_cpu is invalid,
+ *          -ENOENT if no CPU in the node has a priority.
+ */
+__bpf_kfunc s32 bpf_sys_info_get_max_prio_and_cpu_node(s32 this_cpu, s32 *cpu, s32 *pid, s64 *prio)
+{
+	if (!(0 <= this_cpu && this_cpu < sys_info_desc.nr_cpus))
+		return -EINVAL;
+
+	return sys_info_get_max_prio_and_cpu_in(&sys_info_desc, cpumask_of_node(cpu_to_node(this_cpu)),
+						cpu, pid, prio);
+}
+
 __bpf_kfunc_end_defs();
 
 BTF_KFUNCS_START(my_ops_kfunc_ids)
 BTF_ID_FLAGS(func, bpf_dag_task_alloc, KF_ACQUIRE | KF_RET_NULL)
+BTF_ID_FLAGS(func, bpf_dag_task_alloc_bulk, KF_ACQUIRE | KF_RET_NULL)
 BTF_ID_FLAGS(func, bpf_dag_task_free, KF_RELEASE)
 BTF_ID_FLAGS(func, bpf_dag_task_add_node, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_add_edge, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_reserve, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_get_node_id, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_commit, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_get_weight, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_set_weight, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_set_weights, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_get_prio, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_culc_HELT_prio, KF_TRUSTED_ARGS)
 BTF_ID_FLAGS(func, bpf_dag_task_culc_HLBS_prio, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_culc_slack, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_get_slack, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_job_release, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_job_complete, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_job_get_prio, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_job_get_deadline, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_node_complete, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_job_get_pending, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_node_start, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_node_stop, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_get_runtime_est, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_get_volume, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_get_critical_path, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_task_federated_assign)
+BTF_ID_FLAGS(func, bpf_dag_task_get_cpumask, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_rq_push, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_rq_remove, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_dag_rq_pop_min)
+BTF_ID_FLAGS(func, bpf_dag_rq_peek_min)
+BTF_ID_FLAGS(func, bpf_dag_rq_steal)
 BTF_ID_FLAGS(func, bpf_dag_task_dump)
+BTF_ID_FLAGS(func, bpf_dag_prio_encode)
+BTF_ID_FLAGS(func, bpf_dag_prio_decode_time)
+BTF_ID_FLAGS(func, bpf_dag_prio_decode_dag)
+BTF_ID_FLAGS(func, bpf_dag_prio_decode_rank)
 BTF_ID_FLAGS(func, bpf_sys_info_update_cpu_prio)
 BTF_ID_FLAGS(func, bpf_sys_info_get_max_prio_and_cpu)
+BTF_ID_FLAGS(func, bpf_sys_info_get_max_prio_and_cpu_in, KF_TRUSTED_ARGS)
+BTF_ID_FLAGS(func, bpf_sys_info_get_max_prio_and_cpu_llc)
+BTF_ID_FLAGS(func, bpf_sys_info_get_max_prio_and_cpu_node)
+BTF_ID_FLAGS(func, bpf_sys_info_get_victims)
+BTF_ID_FLAGS(func, bpf_sys_info_release_cpu)
 BTF_KFUNCS_END(my_ops_kfunc_ids)
 
 BTF_ID_LIST(dag_task_dtor_ids)
@@ -898,10 +4054,53 @@ static ssize_t ctl_store(struct kobject *kobj, struct kobj_attribute *attr,
 	return count;
 }
 
+#ifdef DAG_BPF_BENCH
+static ssize_t sys_info_bench_show(struct kobject *kobj, struct kobj_attribute *attr,
+				   char *buf)
+{
+	s64 legacy_ns, ns;
+
+	legacy_ns = sys_info_bench_run(true);
+	if (legacy_ns < 0)
+		return legacy_ns;
+
+	ns = sys_info_bench_run(false);
+	if (ns < 0)
+		return ns;
+
+	return sysfs_emit(buf, "legacy: %lld ns/op\nlock-free: %lld ns/op\n", legacy_ns, ns);
+}
+#endif
+
+static ssize_t urb_drain_show(struct kobject *kobj, struct kobj_attribute *attr,
+			      char *buf)
+{
+	return sysfs_emit(buf, "runs: %llu\ndrained: %llu\ndepth: %u\nmax_depth: %u\n",
+			  READ_ONCE(urb_drain_stats.runs), READ_ONCE(urb_drain_stats.drained),
+			  READ_ONCE(urb_drain_stats.depth), READ_ONCE(urb_drain_stats.max_depth));
+}
+
+// Any write drains urb right away.
+static ssize_t urb_drain_store(struct kobject *kobj, struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	if (!READ_ONCE(gops.drain))
+		return -ENODEV;
+
+	urb_drain_kick();
+	return count;
+}
+
 // sysfs:my_ops dir
 static struct kobject *my_ops_kobj;
 // sysfs:my_ops/ctl file
 static struct kobj_attribute ctl_attr = __ATTR(ctl, 0660, ctl_show, ctl_store);
+#ifdef DAG_BPF_BENCH
+// sysfs:my_ops/sys_info_bench file
+static struct kobj_attribute sys_info_bench_attr = __ATTR(sys_info_bench, 0440, sys_info_bench_show, NULL);
+#endif
+// sysfs:my_ops/urb_drain file
+static struct kobj_attribute urb_drain_attr = __ATTR(urb_drain, 0660, urb_drain_show, urb_drain_store);
 
 // init/exit
 static int __init my_ops_init(void)
@@ -911,6 +4110,7 @@ static int __init my_ops_init(void)
 	pr_info("my_ops_init\n");
 
 	memset(&gops, 0, sizeof(struct my_ops));
+	INIT_DELAYED_WORK(&urb_drain_work, urb_drain_fn);
 
 	my_ops_kobj = kobject_create_and_add("my_ops", kernel_kobj);
 	if (!my_ops_kobj) {
@@ -921,26 +4121,75 @@ static int __init my_ops_init(void)
 	err = sysfs_create_file(my_ops_kobj, &ctl_attr.attr);
 	if (err) {
 		pr_err("failed to create file sysfs:my_ops/ctl\n");
-		return err;
+		goto err_kobj;
+	}
+
+#ifdef DAG_BPF_BENCH
+	err = sysfs_create_file(my_ops_kobj, &sys_info_bench_attr.attr);
+	if (err) {
+		pr_err("failed to create file sysfs:my_ops/sys_info_bench\n");
+		goto err_kobj;
+	}
+#endif
+
+	err = sysfs_create_file(my_ops_kobj, &urb_drain_attr.attr);
+	if (err) {
+		pr_err("failed to create file sysfs:my_ops/urb_drain\n");
+		goto err_kobj;
+	}
+
+	err = bpf_sys_info_init();
+	if (err) {
+		pr_err("Failed to init sys_info (%d)", err);
+		goto err_kobj;
 	}
 
-	bpf_sys_info_init();
+	err = bpf_dag_rq_init();
+	if (err) {
+		pr_err("Failed to init dag_rq (%d)", err);
+		goto err_sys_info;
+	}
 
-	bpf_dag_task_manager_init();
+	err = bpf_dag_task_manager_init();
+	if (err) {
+		pr_err("Failed to init bpf_dag_task_manager (%d)", err);
+		goto err_dag_rq;
+	}
 
 	err = dag_task_kfunc_init();
 	if (err) {
 		pr_err("Failed to init kfunc (%d)", err);
-		return err;
+		goto err_manager;
 	}
 
 	err = register_bpf_struct_ops(&bpf_my_ops, my_ops);
 	if (err) {
 		pr_err("failed to register struct_ops my_ops\n");
-		return err;
+		goto err_manager;
+	}
+
+	err = register_bpf_struct_ops(&bpf_dag_sched_ops, dag_sched_ops);
+	if (err) {
+		pr_err("failed to register struct_ops dag_sched_ops\n");
+		goto err_manager;
 	}
 
 	return 0;
+
+	/*
+	 * The kfuncs and the struct_ops registered so far go away with the BTF
+	 * of the module, but the hotplug callbacks of sys_info must be removed
+	 * before the module is freed.
+	 */
+err_manager:
+	bpf_dag_task_manager_exit();
+err_dag_rq:
+	bpf_dag_rq_exit();
+err_sys_info:
+	bpf_sys_info_exit();
+err_kobj:
+	kobject_put(my_ops_kobj);
+	return err;
 }
 
 static void __exit my_ops_exit(void)
@@ -948,6 +4197,11 @@ static void __exit my_ops_exit(void)
 	pr_info("my_ops_exit\n");
 
 	kobject_put(my_ops_kobj);
+	cancel_delayed_work_sync(&urb_drain_work);
+
+	bpf_dag_task_manager_exit();
+	bpf_dag_rq_exit();
+	bpf_sys_info_exit();
 }
 
 module_init(my_ops_init);
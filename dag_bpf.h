@@ -2,9 +2,42 @@
 #ifndef __DAG_BPF_H
 #define __DAG_BPF_H
 
-#define DAG_TASK_MAX_NODES	20
-#define DAG_TASK_MAX_DEG	20
-#define DAG_TASK_MAX_EDGES	1000
+/*
+ * Upper bounds of a single DAG task. The storage of a DAG task is sized by
+ * the actual number of nodes and edges, so these only bound the size of
+ * a single allocation.
+ */
+#define DAG_TASK_MAX_NODES	8192
+#define DAG_TASK_MAX_EDGES	65536
+
+/*
+ * The number of job instances of a DAG task that can be active at once.
+ */
+#define DAG_TASK_MAX_JOBS	8
+
+/*
+ * Priority key used by bpf_dag_task_get_prio() and the sys_info kfuncs.
+ * A smaller key means a higher priority, and keys are compared as a whole:
+ *   bits 62..23: time in units of 2^14 ns (about 16 us), up to 2^54 ns
+ *                (the deadline with HELT, the latest start time with HLBS)
+ *   bits 22..13: id of the DAG task
+ *   bits 12..0 : rank within the DAG task
+ * The rank is the position of the node in its DAG task's priority order
+ * (by HELT rank, or by exact latest start time with HLBS), so the nodes of a
+ * DAG task are ordered exactly even when their times share a unit. The DAG
+ * task id breaks the ties between DAG tasks whose times share a unit, so the
+ * nodes of different DAG tasks never interleave and their keys never collide.
+ */
+#define DAG_PRIO_RANK_BITS	13
+#define DAG_PRIO_RANK_MASK	((1U << DAG_PRIO_RANK_BITS) - 1)
+#define DAG_PRIO_DAG_BITS	10
+#define DAG_PRIO_DAG_MASK	((1U << DAG_PRIO_DAG_BITS) - 1)
+#define DAG_PRIO_TIME_SHIFT	14
+
+/*
+ * The ids of DAG tasks are below this, so that they fit in a priority key.
+ */
+#define DAG_TASK_MAX_IDS	(DAG_PRIO_DAG_MASK + 1)
 typedef unsigned long long u64;
 typedef long long s64;
 typedef int s32;
@@ -13,14 +46,8 @@ typedef unsigned char u8;
 
 struct node_info {
 	u32 tid;
-	s64 weight;
-
-	s64 prio; /* (internal) */
-
 	u32 nr_ins; // 入力辺の数
-	u32 ins[DAG_TASK_MAX_DEG];
 	u32 nr_outs; // 出力辺の数
-	u32 outs[DAG_TASK_MAX_DEG];
 };
 
 struct edge_info {
@@ -28,16 +55,263 @@ struct edge_info {
 	u32 to;
 };
 
+/*
+ * A DAG task packed into a single message, passed to bpf_dag_task_alloc_bulk().
+ * The header is followed by
+ *   struct bpf_dag_bulk_node nodes[nr_nodes]; // nodes[0] is the source node
+ *   struct edge_info edges[nr_edges];         // pairs of node ids
+ */
+struct bpf_dag_bulk_graph {
+	u32 nr_nodes;
+	u32 nr_edges;
+	s64 relative_deadline;
+	s64 period;
+};
+
+struct bpf_dag_bulk_node {
+	u32 tid;
+	u32 weight;
+};
+
+/*
+ * Open-addressing hash table used as an index of a DAG task. (internal)
+ */
+struct dag_hash_entry {
+	u64 key;
+	u32 val;
+};
+
+struct dag_hash {
+	u32 nr_entries;
+	u32 nr_buckets; // zero or a power of two
+	struct dag_hash_entry *buckets;
+};
+
+/*
+ * An element of the array passed to bpf_dag_task_set_weights().
+ */
+struct bpf_dag_weight_update {
+	u32 node_id;
+	u32 __pad;
+	s64 weight;
+};
+
+/*
+ * A job instance of a DAG task. (internal)
+ * The slot of the job whose handle is seq is jobs[seq % DAG_TASK_MAX_JOBS].
+ * seq is published with smp_store_release() once the job is initialized.
+ * users counts the active job itself and the kfuncs using the slot, and the
+ * slot is reused only once it drops to 0.
+ */
+struct bpf_dag_job {
+	u64 seq; // the job handle, 0 if the job isn't active
+	atomic_t users;
+	s64 release;
+	s64 deadline;
+	s64 *prio; // the priority key of each node
+	/*
+	 * The number of unfinished predecessors of each node. 0 means ready,
+	 * and -1 means the node finished in this job.
+	 */
+	atomic_t *pending;
+};
+
+/*
+ * The online estimate of the execution time of a node per job, in ns.
+ * Filled by bpf_dag_task_get_runtime_est().
+ */
+struct bpf_dag_runtime_est {
+	s64 last; // the runtime measured last
+	s64 ewma; // the exponentially weighted moving average (1/8)
+	s64 pctl; // the estimate of the est_pctl per-mille percentile
+	u64 nr_samples;
+};
+
+/*
+ * The start times of a node filled by bpf_dag_task_get_slack(), in ns
+ * relative to the release of a job.
+ */
+struct bpf_dag_node_slack {
+	s64 earliest_start; // if every node ran as soon as its predecessors finished
+	s64 latest_start;   // the latest start that still meets the relative deadline
+	s64 slack;          // latest_start - earliest_start, negative if infeasible
+};
+
+/*
+ * An entry of a ready queue. Each node of a committed DAG task has one, so a
+ * node is in at most one ready queue at a time. (internal)
+ */
+struct dag_rq;
+
+struct dag_rq_entry {
+	struct rb_node rb_node;
+	s64 prio;
+	u64 job;
+	struct dag_rq *rq; // the ready queue holding this entry, NULL if none
+	u32 dag_id;
+	u32 node_id;
+	s32 tid;
+};
+
+/*
+ * An entry filled by bpf_dag_rq_pop_min(), bpf_dag_rq_peek_min() and
+ * bpf_dag_rq_steal().
+ */
+struct bpf_dag_rq_item {
+	u32 dag_id;
+	u32 node_id;
+	u64 job; // 0 if the node was pushed without a job
+	s32 tid;
+	s32 cpu; // the ready queue it was taken from, BPF_DAG_RQ_GLOBAL for the global one
+	s64 prio;
+};
+
+/*
+ * The priority policy last computed for a DAG task. (internal)
+ */
+enum bpf_dag_prio_policy {
+	BPF_DAG_PRIO_NONE = 0,
+	BPF_DAG_PRIO_HELT,
+	BPF_DAG_PRIO_HLBS,
+};
+
 struct bpf_dag_task {
+	/*
+	 * Hot data read on every scheduling decision.
+	 * prio[i] and weight[i] are the priority and the weight of node i.
+	 */
 	u32 id;
 	u32 nr_nodes;
-	struct node_info nodes[DAG_TASK_MAX_NODES];
-	u32 nr_edges;
-	struct edge_info edges[DAG_TASK_MAX_EDGES];
+	s64 *prio; /* (internal) */
+	s64 *weight;
 	s64 relative_deadline;
 	s64 deadline;
 	s64 period;
-	u32 buf[DAG_TASK_MAX_NODES];
+	bool committed; // no more nodes or edges can be added
+
+	/*
+	 * State kept by the priority computations so that a weight change can
+	 * be propagated incrementally. (internal)
+	 * rank[i] is the HELT rank, or the HLBS latest start time, of node i.
+	 * order[] holds the node ids from the least to the most urgent: by
+	 * (rank, node id) with HELT, and by (latest start time, node id) in
+	 * descending order with HLBS. pos[i] is the index of node i in order[].
+	 * lock serializes the writers of this state, weight[], deadline and prio[]
+	 * (the priority computations and the weight changes) with the job
+	 * releases that take a snapshot of it.
+	 */
+	spinlock_t lock;
+	u32 prio_policy; // enum bpf_dag_prio_policy
+	s64 *rank;
+	u32 *order;
+	u32 *pos;
+
+	/*
+	 * Filled by bpf_dag_task_culc_slack(). The times are relative to the
+	 * release of a job, in ns. Changing a weight or the shape of the graph
+	 * makes them stale. (internal)
+	 */
+	bool slack_valid;
+	s64 *earliest_start;
+	s64 *latest_start;
+
+	/*
+	 * The ring of active job instances. The per-node arrays are allocated
+	 * by commit. (internal)
+	 */
+	u64 last_job; // the handle of the last released job
+	struct bpf_dag_job jobs[DAG_TASK_MAX_JOBS];
+
+	/*
+	 * The execution time estimate of each node, allocated by commit.
+	 * exec_start[i] is the sum_exec_runtime of node i when it started,
+	 * or -1 if it isn't running. (internal)
+	 */
+	struct bpf_dag_runtime_est *est;
+	s64 *exec_start;
+
+	/*
+	 * The ready queue entry of each node, allocated by commit. (internal)
+	 */
+	struct dag_rq_entry *rq_entries;
+
+	/*
+	 * Federated scheduling. volume (C) is the sum of the weights and
+	 * critical_path (L) is the length of the longest path. Both are kept up
+	 * to date under lock as nodes, edges and weights change: critical_path
+	 * is recomputed lazily when it's stale before commit, and eagerly by
+	 * the weight changes after it, so bpf_dag_task_federated_assign() only
+	 * reads them. nr_cores and cpus are set by
+	 * bpf_dag_task_federated_assign() under the lock of the manager, and
+	 * federated_nr_cores is its scratch space. (internal)
+	 */
+	s64 volume;
+	s64 critical_path;
+	bool critical_path_stale;
+	u32 nr_cores; // the dedicated cores of a heavy DAG task, 0 if light
+	s32 federated_nr_cores; // nr_cores computed by the first pass, -1 if skipped
+	cpumask_var_t cpus;
+
+	/*
+	 * Cold data used to build and inspect the graph.
+	 */
+	u32 max_nr_nodes; // the capacity of the per-node arrays
+	struct node_info *nodes;
+	u32 nr_edges;
+	u32 max_nr_edges; // the capacity of edges
+	struct edge_info *edges; // NULL after commit
+
+	struct dag_hash tid_index;  // tid -> node id
+	struct dag_hash edge_index; // (from, to) -> edge id, empty after commit
+
+	/*
+	 * Compressed sparse row (CSR) adjacency built from edges. (internal)
+	 * The successors of node i are outs[out_offs[i]] .. outs[out_offs[i + 1] - 1]
+	 * and its predecessors are ins[in_offs[i]] .. ins[in_offs[i + 1] - 1].
+	 * Adding a node or an edge invalidates it.
+	 */
+	bool csr_valid;
+	u32 *out_offs;
+	u32 *outs;
+	u32 *in_offs;
+	u32 *ins;
+
+	u32 *buf;
+	unsigned long *queued; // bitmap of nodes in the worklist of the incremental update
+
+	/*
+	 * The block allocated by commit. It packs prio, weight, rank, order,
+	 * pos and the start times first, then the CSR adjacency, buf and
+	 * queued, the runtime estimates, the ready queue entries, and the
+	 * priorities of the jobs last, so the hot arrays don't share cache
+	 * lines with the cold ones. (internal)
+	 */
+	void *frozen;
+};
+
+/*
+ * An element of the array filled by bpf_sys_info_get_victims().
+ */
+struct bpf_sys_info_victim {
+	s32 cpu;
+	s32 pid;
+	s64 prio;
 };
 
+/*
+ * Flags of bpf_sys_info_get_victims()
+ */
+#define BPF_SYS_INFO_RESERVE	(1U << 0) // reserve the returned CPUs
+
+/*
+ * Flags of bpf_dag_task_node_stop()
+ */
+#define BPF_DAG_EST_SET_WEIGHT_EWMA	(1U << 0) // write the EWMA back into weight
+#define BPF_DAG_EST_SET_WEIGHT_PCTL	(1U << 1) // write the percentile back into weight
+
+/*
+ * The cpu argument of the bpf_dag_rq kfuncs selecting the global ready queue
+ */
+#define BPF_DAG_RQ_GLOBAL	(-1)
+
 #endif
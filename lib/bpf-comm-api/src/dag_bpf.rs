@@ -2,10 +2,51 @@ use linux_utils::LinuxTid;
 
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
-enum MsgType {
+pub enum MsgType {
 	NewTask = 0,
 	AddNode = 1,
 	AddEdge = 2,
+	Commit = 3,
+	BulkGraph = 4,
+}
+
+/// The maximum size of the payload of a bulk graph message accepted by the BPF program.
+pub const BULK_GRAPH_MAX_SIZE: usize = 1 << 20;
+
+// Every message begins with this header. `seq` is echoed back in the ack of the message.
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+struct MsgHeader {
+	msg_type: u32,
+	_pad: u32,
+	seq: u64,
+}
+
+/// A record of the `dag_acks` ring buffer, posted by the BPF program for every message it drains.
+/// Mirrors `struct bpf_dag_msg_ack`.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub struct MsgAck {
+	pub seq: u64,
+	pub msg_type: u32,
+	_pad: u32,
+	/// The id of the created DAG task, node or edge (0 for a commit) if not negative, otherwise an error.
+	pub ret: i64,
+}
+
+impl MsgAck {
+	pub fn from_bytes(data: &[u8]) -> Option<Self>
+	{
+		if data.len() < std::mem::size_of::<Self>() {
+			return None;
+		}
+		Some(unsafe { std::ptr::read_unaligned(data.as_ptr() as *const Self) })
+	}
+
+	pub fn is_ok(&self) -> bool
+	{
+		self.ret >= 0
+	}
 }
 
 #[repr(C)]
@@ -33,11 +74,59 @@ pub struct MsgAddEdgePayload {
 	to_tid: LinuxTid,
 }
 
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MsgCommitPayload {
+	dag_task_id: LinuxTid,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MsgBulkGraphHeader {
+	nr_nodes: u32,
+	nr_edges: u32,
+	relative_deadline: i64,
+	period: i64,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MsgBulkGraphNode {
+	tid: LinuxTid,
+	weight: u32,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MsgBulkGraphEdge {
+	from: u32, // node index
+	to: u32,   // node index
+}
+
+// A whole DAG task in one message. It's encoded as the header followed by the nodes and the edges.
+#[derive(Debug, Clone)]
+pub struct MsgBulkGraphPayload {
+	header: MsgBulkGraphHeader,
+	nodes: Vec<MsgBulkGraphNode>,
+	edges: Vec<MsgBulkGraphEdge>,
+}
+
+impl MsgBulkGraphPayload {
+	pub fn size(&self) -> usize
+	{
+		std::mem::size_of::<MsgBulkGraphHeader>()
+			+ self.nodes.len() * std::mem::size_of::<MsgBulkGraphNode>()
+			+ self.edges.len() * std::mem::size_of::<MsgBulkGraphEdge>()
+	}
+}
+
 #[derive(Debug)]
 pub enum DagBpfMsg {
 	NewTask(MsgNewTaskPayload),
 	AddNode(MsgAddNodePayload),
 	AddEdge(MsgAddEdgePayload),
+	Commit(MsgCommitPayload),
+	BulkGraph(MsgBulkGraphPayload),
 	Unknown, // fallback for unknown types
 }
 
@@ -57,30 +146,97 @@ impl DagBpfMsg {
 		DagBpfMsg::AddEdge(MsgAddEdgePayload { dag_task_id, from_tid, to_tid, })
 	}
 
+	pub fn commit(dag_task_id: LinuxTid) -> Self
+	{
+		DagBpfMsg::Commit(MsgCommitPayload { dag_task_id, })
+	}
+
+	// nodes[0] must be the source node, and the edges are pairs of node indices
+	// with from < to.
+	pub fn bulk_graph(relative_deadline: i64, period: i64, nodes: &[(LinuxTid, u32)], edges: &[(u32, u32)]) -> Self
+	{
+		DagBpfMsg::BulkGraph(MsgBulkGraphPayload {
+			header: MsgBulkGraphHeader {
+				nr_nodes: nodes.len() as u32,
+				nr_edges: edges.len() as u32,
+				relative_deadline,
+				period,
+			},
+			nodes: nodes.iter().map(|&(tid, weight)| MsgBulkGraphNode { tid, weight }).collect(),
+			edges: edges.iter().map(|&(from, to)| MsgBulkGraphEdge { from, to }).collect(),
+		})
+	}
+
+	pub fn msg_type(&self) -> MsgType
+	{
+		match self {
+			DagBpfMsg::NewTask(_) => MsgType::NewTask,
+			DagBpfMsg::AddNode(_) => MsgType::AddNode,
+			DagBpfMsg::AddEdge(_) => MsgType::AddEdge,
+			DagBpfMsg::Commit(_) => MsgType::Commit,
+			DagBpfMsg::BulkGraph(_) => MsgType::BulkGraph,
+			DagBpfMsg::Unknown => panic!("Unknown msg type"),
+		}
+	}
+
 	pub fn as_bytes(&self) -> Vec<u8>
 	{
-		let mut buffer = Vec::with_capacity(std::mem::size_of::<u32>() + std::mem::size_of::<MsgNewTaskPayload>());
+		self.encode(0)
+	}
+
+	// Encodes the message with the sequence number `seq`, which the BPF program echoes back in its ack.
+	pub fn encode(&self, seq: u64) -> Vec<u8>
+	{
+		let mut buffer = vec![0; self.encoded_len()];
+		self.encode_into(seq, &mut buffer);
+		buffer
+	}
 
-		let msg_type = match self {
-			DagBpfMsg::NewTask(_) => MsgType::NewTask as i32,
-			DagBpfMsg::AddNode(_) => MsgType::AddNode as i32,
-			DagBpfMsg::AddEdge(_) => MsgType::AddEdge as i32,
+	// Returns the size of the encoded message.
+	pub fn encoded_len(&self) -> usize
+	{
+		let payload_len = match self {
+			DagBpfMsg::NewTask(_) => std::mem::size_of::<MsgNewTaskPayload>(),
+			DagBpfMsg::AddNode(_) => std::mem::size_of::<MsgAddNodePayload>(),
+			DagBpfMsg::AddEdge(_) => std::mem::size_of::<MsgAddEdgePayload>(),
+			DagBpfMsg::Commit(_) => std::mem::size_of::<MsgCommitPayload>(),
+			DagBpfMsg::BulkGraph(payload) => payload.size(),
 			DagBpfMsg::Unknown => panic!("Unknown msg type"),
 		};
-		buffer.extend_from_slice(&msg_type.to_ne_bytes());
+		std::mem::size_of::<MsgHeader>() + payload_len
+	}
+
+	// Encodes the message into `buf` in place, e.g. into the space reserved in the user ring buffer.
+	// `buf` must be at least `encoded_len()` bytes long. Returns the number of bytes written.
+	pub fn encode_into(&self, seq: u64, buf: &mut [u8]) -> usize
+	{
+		let header = MsgHeader { msg_type: self.msg_type() as u32, _pad: 0, seq };
+		let mut off = put(buf, 0, as_bytes(&header));
 
-		let payload = match self {
-			DagBpfMsg::NewTask(payload) => as_bytes(payload),
-			DagBpfMsg::AddNode(payload) => as_bytes(payload),
-			DagBpfMsg::AddEdge(payload) => as_bytes(payload),
+		off = match self {
+			DagBpfMsg::NewTask(payload) => put(buf, off, as_bytes(payload)),
+			DagBpfMsg::AddNode(payload) => put(buf, off, as_bytes(payload)),
+			DagBpfMsg::AddEdge(payload) => put(buf, off, as_bytes(payload)),
+			DagBpfMsg::Commit(payload) => put(buf, off, as_bytes(payload)),
+			DagBpfMsg::BulkGraph(payload) => {
+				let off = put(buf, off, as_bytes(&payload.header));
+				let off = put(buf, off, slice_as_bytes(&payload.nodes));
+				put(buf, off, slice_as_bytes(&payload.edges))
+			}
 			DagBpfMsg::Unknown => panic!("Unknown msg type"),
 		};
-		buffer.extend_from_slice(payload);
 
-		buffer
+		off
 	}
 }
 
+// Copies `bytes` to `buf` at `off`, and returns the offset after them.
+fn put(buf: &mut [u8], off: usize, bytes: &[u8]) -> usize
+{
+	buf[off..off + bytes.len()].copy_from_slice(bytes);
+	off + bytes.len()
+}
+
 // util function
 // This function converts the instance of type `T` into bytes sequence.
 fn as_bytes<'a, T>(val: &'a T) -> &'a [u8]
@@ -92,3 +248,77 @@ fn as_bytes<'a, T>(val: &'a T) -> &'a [u8]
 		)
 	}
 }
+
+// This function converts the slice of `T` into bytes sequence.
+fn slice_as_bytes<'a, T>(vals: &'a [T]) -> &'a [u8]
+{
+	unsafe {
+		std::slice::from_raw_parts(
+			vals.as_ptr() as *const u8,
+			std::mem::size_of_val(vals),
+		)
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn bulk_graph_layout() {
+		let nodes = [(1000, 1), (1001, 3), (1002, 1)];
+		let edges = [(0, 1), (0, 2)];
+		let bytes = DagBpfMsg::bulk_graph(100, 200, &nodes, &edges).as_bytes();
+
+		let word = |off: usize| u32::from_ne_bytes(bytes[off..off + 4].try_into().unwrap());
+		let dword = |off: usize| i64::from_ne_bytes(bytes[off..off + 8].try_into().unwrap());
+
+		assert_eq!(bytes.len(), 16 + 24 + 3 * 8 + 2 * 8);
+		assert_eq!(word(0), MsgType::BulkGraph as u32);
+		assert_eq!((word(16), word(20)), (3, 2));
+		assert_eq!((dword(24), dword(32)), (100, 200));
+		assert_eq!((word(40), word(44)), (1000, 1)); // the source node
+		assert_eq!((word(64), word(68)), (0, 1)); // the first edge
+	}
+
+	#[test]
+	fn header_carries_seq() {
+		let bytes = DagBpfMsg::commit(1000).encode(42);
+
+		assert_eq!(bytes.len(), 16 + 4);
+		assert_eq!(u32::from_ne_bytes(bytes[0..4].try_into().unwrap()), MsgType::Commit as u32);
+		assert_eq!(u64::from_ne_bytes(bytes[8..16].try_into().unwrap()), 42);
+		assert_eq!(u32::from_ne_bytes(bytes[16..20].try_into().unwrap()), 1000);
+	}
+
+	#[test]
+	fn encode_into_matches_encode() {
+		let msgs = [
+			DagBpfMsg::new_task(1000, 1, 100, 200),
+			DagBpfMsg::add_node(1000, 1001, 3),
+			DagBpfMsg::add_edge(1000, 1000, 1001),
+			DagBpfMsg::commit(1000),
+			DagBpfMsg::bulk_graph(100, 200, &[(1000, 1), (1001, 3)], &[(0, 1)]),
+		];
+
+		for msg in &msgs {
+			let mut buf = vec![0xff; msg.encoded_len() + 8];
+			assert_eq!(msg.encode_into(7, &mut buf), msg.encoded_len());
+			assert_eq!(&buf[..msg.encoded_len()], &msg.encode(7)[..]);
+		}
+	}
+
+	#[test]
+	fn ack_layout() {
+		let mut bytes = Vec::new();
+		bytes.extend_from_slice(&7u64.to_ne_bytes());
+		bytes.extend_from_slice(&(MsgType::AddEdge as u32).to_ne_bytes());
+		bytes.extend_from_slice(&0u32.to_ne_bytes());
+		bytes.extend_from_slice(&(-22i64).to_ne_bytes());
+
+		let ack = MsgAck::from_bytes(&bytes).unwrap();
+		assert_eq!((ack.seq, ack.msg_type, ack.ret), (7, MsgType::AddEdge as u32, -22));
+		assert!(!ack.is_ok());
+		assert!(MsgAck::from_bytes(&bytes[..16]).is_none());
+	}
+}
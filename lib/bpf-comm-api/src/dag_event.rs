@@ -0,0 +1,64 @@
+// A record of the dag_events ring buffer, struct bpf_dag_event on the BPF side.
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default)]
+pub struct DagEvent {
+	pub event_type: u32,
+	pub id: u32,
+	pub ts: u64, // bpf_ktime_get_ns()
+	pub arg0: u64,
+	pub arg1: i64,
+}
+
+// The decoded meaning of a `DagEvent`. `msg_type` is the type of the urb message that caused it.
+#[derive(Debug, PartialEq, Eq)]
+pub enum DagEventKind {
+	GraphChange { dag_task_id: u32, msg_type: u32, id: i64 }, // id: the node id or the edge id added, otherwise 0
+	PrioRecompute { dag_task_id: u32, nr_changed: u64 },
+	JobRelease { dag_task_id: u32, job: u64 },
+	DeadlineMiss { dag_task_id: u32, job: u64, lateness: i64 },
+	Error { src_node_tid: u32, msg_type: u32, err: i64 },
+	Unknown(u32), // fallback for unknown types
+}
+
+impl DagEvent {
+	// Decodes a record in place. Returns None if `bytes` is too short.
+	pub fn from_bytes(bytes: &[u8]) -> Option<DagEvent>
+	{
+		if bytes.len() < std::mem::size_of::<DagEvent>() {
+			return None;
+		}
+		Some(unsafe { std::ptr::read_unaligned(bytes.as_ptr() as *const DagEvent) })
+	}
+
+	pub fn kind(&self) -> DagEventKind
+	{
+		match self.event_type {
+			0 => DagEventKind::GraphChange { dag_task_id: self.id, msg_type: self.arg0 as u32, id: self.arg1 },
+			1 => DagEventKind::PrioRecompute { dag_task_id: self.id, nr_changed: self.arg0 },
+			2 => DagEventKind::JobRelease { dag_task_id: self.id, job: self.arg0 },
+			3 => DagEventKind::DeadlineMiss { dag_task_id: self.id, job: self.arg0, lateness: self.arg1 },
+			4 => DagEventKind::Error { src_node_tid: self.id, msg_type: self.arg0 as u32, err: self.arg1 },
+			t => DagEventKind::Unknown(t),
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn decode() {
+		let mut bytes = Vec::new();
+		bytes.extend_from_slice(&3u32.to_ne_bytes());
+		bytes.extend_from_slice(&7u32.to_ne_bytes());
+		bytes.extend_from_slice(&100u64.to_ne_bytes());
+		bytes.extend_from_slice(&42u64.to_ne_bytes());
+		bytes.extend_from_slice(&(-5i64).to_ne_bytes());
+
+		let event = DagEvent::from_bytes(&bytes).unwrap();
+		assert_eq!(event.ts, 100);
+		assert_eq!(event.kind(), DagEventKind::DeadlineMiss { dag_task_id: 7, job: 42, lateness: -5 });
+		assert!(DagEvent::from_bytes(&bytes[..31]).is_none());
+	}
+}
@@ -1 +1,2 @@
 pub mod dag_bpf;
+pub mod dag_event;
@@ -0,0 +1,56 @@
+use std::os::raw::c_void;
+
+use libbpf_sys::bpf_map_lookup_elem;
+
+use crate::utils::get_errno_string;
+use crate::map::find_bpf_map_by_name;
+use crate::map::BpfMap;
+
+
+/*
+ * Structure for BPF map type `BPF_MAP_TYPE_HASH`.
+ */
+pub struct HashMap {
+	pub bpf_map: BpfMap,
+}
+
+impl HashMap {
+	pub fn new(map_name: &str) -> Result<HashMap, String>
+	{
+		let bpf_map = find_bpf_map_by_name(map_name)?;
+		Ok(HashMap {
+			bpf_map
+		})
+	}
+
+	/*
+	 * Perform bpf_map_lookup_elem for @self.
+	 * The types of @key and @value must match the key and the value type of the map.
+	 * This function overwrites @value.
+	 */
+	pub fn lookup_elem<K, V>(&self, key: &K, value: &mut V) -> Result<(), String>
+	{
+		let err;
+		unsafe {
+			err = bpf_map_lookup_elem(
+				self.bpf_map.map_fd,
+				key as *const K as *const c_void,
+				value as *mut V as *mut c_void
+			);
+		}
+
+		if err < 0 {
+			Err(format!("lookup_elem: errno {}", get_errno_string()))
+		} else {
+			Ok(())
+		}
+	}
+}
+
+impl Drop for HashMap {
+	fn drop(&mut self) {
+		unsafe {
+			libc::close(self.bpf_map.map_fd);
+		}
+	}
+}
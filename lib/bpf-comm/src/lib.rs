@@ -1,5 +1,7 @@
 pub mod map;
 pub mod urb;
+pub mod ring_buffer;
 pub mod task_storage;
+pub mod hash_map;
 
 mod utils;
@@ -1,9 +1,16 @@
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::path::Path;
+use std::sync::Mutex;
 use std::{mem::size_of, os::raw::c_void};
 
-use libbpf_sys::{bpf_map_get_fd_by_id, bpf_map_get_next_id, bpf_map_info, bpf_obj_get_info_by_fd};
+use libbpf_sys::{bpf_map_get_fd_by_id, bpf_map_get_next_id, bpf_map_info, bpf_obj_get, bpf_obj_get_info_by_fd};
 use libc::{__u32, close};
 
 
+/// The directory of bpffs where the loader pins the BPF maps, each under its name.
+pub const BPF_MAP_PIN_DIR: &str = "/sys/fs/bpf/dag_bpf";
+
 #[derive(Debug)]
 pub struct BpfMap {
 	pub name: String,
@@ -11,64 +18,140 @@ pub struct BpfMap {
 	pub map_fd: i32,
 }
 
+// The IDs of the BPF maps found by the scan, by their names.
+static MAP_ID_CACHE: Mutex<Option<HashMap<String, u32>>> = Mutex::new(None);
+
 /// Searches for the BPF map named `map_name` in the current system.
-/// The search is performed in ascending order of map IDs, and the first map
-/// with a matching name is returned.
-/// 
+/// The map pinned as `map_name` in `BPF_MAP_PIN_DIR` is opened if any.
+/// Otherwise, the search is performed in ascending order of map IDs, and
+/// the first map with a matching name is returned. The IDs of the maps seen
+/// by the search are cached, so the later searches open the map directly.
+///
 /// NOTE: Privileged access is required.
 pub fn find_bpf_map_by_name(map_name: &str) -> Result<BpfMap, String>
 {
 	if !is_root::is_root() {
 		return Err("Run me as root".to_string());
 	}
+
+	if let Some(bpf_map) = open_pinned_bpf_map(&Path::new(BPF_MAP_PIN_DIR).join(map_name), map_name) {
+		return Ok(bpf_map);
+	}
+
+	let cached_id = MAP_ID_CACHE.lock().unwrap().as_ref().and_then(|cache| cache.get(map_name).copied());
+	if let Some(map_id) = cached_id {
+		if let Some(bpf_map) = open_bpf_map_by_id(map_id, map_name) {
+			return Ok(bpf_map);
+		}
+		// The map has gone, e.g. the BPF program has been reloaded.
+		if let Some(cache) = MAP_ID_CACHE.lock().unwrap().as_mut() {
+			cache.remove(map_name);
+		}
+	}
+
+	scan_bpf_maps(map_name)
+}
+
+// Opens the BPF map pinned at `path` if it's named `map_name`.
+fn open_pinned_bpf_map(path: &Path, map_name: &str) -> Option<BpfMap>
+{
+	let path = CString::new(path.to_str()?).ok()?;
+	let map_fd = unsafe { bpf_obj_get(path.as_ptr()) };
+	if map_fd < 0 {
+		return None;
+	}
+	open_bpf_map_by_fd(map_fd, map_name)
+}
+
+// Opens the BPF map with `map_id` if it's named `map_name`.
+fn open_bpf_map_by_id(map_id: u32, map_name: &str) -> Option<BpfMap>
+{
+	let map_fd = unsafe { bpf_map_get_fd_by_id(map_id) };
+	if map_fd < 0 {
+		return None;
+	}
+	open_bpf_map_by_fd(map_fd, map_name)
+}
+
+// Takes `map_fd` if the map is named `map_name`, otherwise closes it.
+fn open_bpf_map_by_fd(map_fd: i32, map_name: &str) -> Option<BpfMap>
+{
+	match get_bpf_map_info(map_fd) {
+		Ok(map_info) if bpf_map_name(&map_info) == map_name => Some(BpfMap {
+			name: map_name.to_string(),
+			map_id: map_info.id,
+			map_fd,
+		}),
+		_ => {
+			unsafe { close(map_fd); }
+			None
+		}
+	}
+}
+
+fn scan_bpf_maps(map_name: &str) -> Result<BpfMap, String>
+{
+	let mut map_ids = HashMap::new();
+	let mut found = None;
 	let mut map_id = 0;
 	loop {
 		let mut next_map_id = 0;
 		let err = unsafe { bpf_map_get_next_id(map_id, &mut next_map_id as *mut __u32) };
 		if err < 0 {
-			return Err(format!("BPF map {map_name} not found"));
+			break;
 		}
 
 		map_id = next_map_id;
 
 		let map_fd = unsafe { bpf_map_get_fd_by_id(map_id) };
 		if map_fd < 0 {
-			return Err(format!("Failed to open BPF map (id={map_id})"))
+			continue; // the map has gone since bpf_map_get_next_id()
 		}
 
-		let mut map_info = bpf_map_info::default();
-		let mut info_len = size_of::<bpf_map_info>() as u32;
-		let err = unsafe {
-			bpf_obj_get_info_by_fd(
-				map_fd,
-				&mut map_info as *mut bpf_map_info as *mut c_void,
-				&mut info_len as *mut __u32)
+		let map_info = match get_bpf_map_info(map_fd) {
+			Ok(map_info) => map_info,
+			Err(_) => {
+				unsafe { close(map_fd); }
+				continue;
+			}
 		};
-		if err < 0 {
+		let name = bpf_map_name(&map_info);
+		map_ids.entry(name.to_string()).or_insert(map_id);
+
+		if found.is_none() && name == map_name {
+			found = Some(BpfMap {
+				name: map_name.to_string(),
+				map_id,
+				map_fd,
+			});
+		} else {
 			unsafe { close(map_fd); }
-			return Err(format!("Failed to get the information of the BPF map (id={map_id})"));
 		}
+	}
 
-		for (i, b) in map_info.name.iter().enumerate() {
-			if *b == 0 {
-				if map_name.as_bytes().len() == i || map_name.as_bytes()[i] == 0 {
-					return Ok(BpfMap{
-						name: map_name.to_string(),
-						map_id,
-						map_fd,
-					});
-				}
-				break;
-			}
+	MAP_ID_CACHE.lock().unwrap().get_or_insert_with(HashMap::new).extend(map_ids);
 
-			if map_name.as_bytes().len() <= i {
-				break;
-			}
+	found.ok_or_else(|| format!("BPF map {map_name} not found"))
+}
 
-			if *b as u8 != map_name.as_bytes()[i] {
-				break;
-			}
-		}
-		unsafe { close(map_fd); }
+fn get_bpf_map_info(map_fd: i32) -> Result<bpf_map_info, String>
+{
+	let mut map_info = bpf_map_info::default();
+	let mut info_len = size_of::<bpf_map_info>() as u32;
+	let err = unsafe {
+		bpf_obj_get_info_by_fd(
+			map_fd,
+			&mut map_info as *mut bpf_map_info as *mut c_void,
+			&mut info_len as *mut __u32)
+	};
+	if err < 0 {
+		return Err(format!("Failed to get the information of the BPF map (fd={map_fd})"));
 	}
+	Ok(map_info)
+}
+
+fn bpf_map_name(map_info: &bpf_map_info) -> &str
+{
+	let name = unsafe { CStr::from_ptr(map_info.name.as_ptr()) };
+	name.to_str().unwrap_or("")
 }
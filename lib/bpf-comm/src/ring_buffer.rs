@@ -0,0 +1,122 @@
+use std::cell::Cell;
+use std::mem::size_of;
+use std::os::raw::{c_int, c_void};
+use std::ptr;
+use std::time::Duration;
+
+use libbpf_sys::ring_buffer;
+use libbpf_sys::ring_buffer__consume;
+use libbpf_sys::ring_buffer__free;
+use libbpf_sys::ring_buffer__new;
+use libbpf_sys::ring_buffer__poll;
+
+use crate::map::find_bpf_map_by_name;
+use crate::map::BpfMap;
+use crate::utils::get_errno_string;
+
+
+/// The handler of the ongoing poll or consume, type-erased so that libbpf can call it.
+struct Handler {
+	f: Cell<*mut c_void>,
+	call: Cell<Option<unsafe fn(*mut c_void, &[u8])>>,
+}
+
+unsafe fn call_handler<F: FnMut(&[u8])>(f: *mut c_void, data: &[u8]) {
+	(*(f as *mut F))(data)
+}
+
+unsafe extern "C" fn sample_cb(ctx: *mut c_void, data: *mut c_void, size: usize) -> c_int {
+	let handler = &*(ctx as *const Handler);
+	if let Some(call) = handler.call.get() {
+		call(handler.f.get(), std::slice::from_raw_parts(data as *const u8, size));
+	}
+	0
+}
+
+/// Structure for BPF map type `BPF_MAP_TYPE_RINGBUF`.
+/// This BPF map is used to receive variable-length records from the BPF side.
+/// The records are passed to the handler in place, without copying or allocating.
+/// You must have privileged access to use it.
+pub struct RingBuffer {
+	pub bpf_map: BpfMap,
+	rb_ptr: *mut ring_buffer,
+	handler: Box<Handler>,
+}
+
+impl RingBuffer {
+	/// Creates a `RingBuffer` instance using `map_name`.
+	/// You must ensure that the BPF map exists.
+	pub fn new(map_name: &str) -> Result<RingBuffer, String> {
+		let bpf_map = find_bpf_map_by_name(map_name)?;
+		let handler = Box::new(Handler {
+			f: Cell::new(ptr::null_mut()),
+			call: Cell::new(None),
+		});
+		let rb_ptr = unsafe {
+			ring_buffer__new(
+				bpf_map.map_fd,
+				Some(sample_cb),
+				&*handler as *const Handler as *mut c_void,
+				ptr::null())
+		};
+		if rb_ptr.is_null() {
+			unsafe { libc::close(bpf_map.map_fd); }
+			return Err(format!("Failed to create ring buffer: errno {}", get_errno_string()));
+		}
+		Ok(RingBuffer {
+			bpf_map,
+			rb_ptr,
+			handler,
+		})
+	}
+
+	/// Waits up to `timeout` for records and passes each of them to `f`.
+	/// Returns the number of the records consumed.
+	pub fn poll<F: FnMut(&[u8])>(&mut self, timeout: Duration, f: F) -> Result<usize, String> {
+		let timeout_ms = timeout.as_millis().min(i32::MAX as u128) as c_int;
+		self.with_handler(f, |rb_ptr| unsafe { ring_buffer__poll(rb_ptr, timeout_ms) })
+	}
+
+	/// Passes each of the records available now to `f` without waiting.
+	/// Returns the number of the records consumed.
+	pub fn consume<F: FnMut(&[u8])>(&mut self, f: F) -> Result<usize, String> {
+		self.with_handler(f, |rb_ptr| unsafe { ring_buffer__consume(rb_ptr) })
+	}
+
+	/// Same as `poll()`, but decodes each record as a `T`, e.g. a `#[repr(C)]`
+	/// mirror of the record type of the BPF side. Records shorter than `T` are skipped.
+	pub fn poll_as<T: Copy, F: FnMut(T)>(&mut self, timeout: Duration, mut f: F) -> Result<usize, String> {
+		self.poll(timeout, |data| {
+			if data.len() >= size_of::<T>() {
+				f(unsafe { ptr::read_unaligned(data.as_ptr() as *const T) });
+			}
+		})
+	}
+
+	fn with_handler<F, P>(&mut self, mut f: F, op: P) -> Result<usize, String>
+	where
+		F: FnMut(&[u8]),
+		P: FnOnce(*mut ring_buffer) -> c_int,
+	{
+		self.handler.f.set(&mut f as *mut F as *mut c_void);
+		self.handler.call.set(Some(call_handler::<F>));
+		let ret = op(self.rb_ptr);
+		self.handler.call.set(None);
+		self.handler.f.set(ptr::null_mut());
+
+		if ret < 0 {
+			Err(format!("ring buffer: errno {}", get_errno_string()))
+		} else {
+			Ok(ret as usize)
+		}
+	}
+}
+
+impl Drop for RingBuffer {
+	fn drop(&mut self) {
+		unsafe {
+			ring_buffer__free(self.rb_ptr);
+			libc::close(self.bpf_map.map_fd);
+		}
+	}
+}
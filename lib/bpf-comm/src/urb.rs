@@ -1,14 +1,22 @@
+use std::marker::PhantomData;
 use std::mem::size_of;
+use std::ops::{Deref, DerefMut};
+use std::os::raw::{c_int, c_void};
 use std::ptr;
+use std::slice;
+use std::time::Duration;
 
 use libbpf_sys::user_ring_buffer;
+use libbpf_sys::user_ring_buffer__discard;
 use libbpf_sys::user_ring_buffer__free;
 use libbpf_sys::user_ring_buffer__new;
 use libbpf_sys::user_ring_buffer__reserve;
+use libbpf_sys::user_ring_buffer__reserve_blocking;
 use libbpf_sys::user_ring_buffer__submit;
 
 use super::map::find_bpf_map_by_name;
 use super::map::BpfMap;
+use super::utils::get_errno_string;
 
 
 /// Structure for BPF map type `BPF_MAP_TYPE_USER_RINGBUF`.
@@ -56,6 +64,7 @@ impl UserRingBuffer {
 		Ok(())
 	}
 
+	/// Sends the bytes `msg` as a message. Fails if there is no room for it.
 	pub fn send_bytes(&mut self, msg: &[u8]) -> Result<(), String> {
 		unsafe {
 			let buf_ptr = user_ring_buffer__reserve(self.urb_ptr, msg.len() as u32);
@@ -70,6 +79,126 @@ impl UserRingBuffer {
 		}
 		Ok(())
 	}
+
+	/// Same as `send_bytes()`, but waits up to `timeout` for the BPF side to drain
+	/// the messages before if there is no room for `msg`.
+	pub fn send_blocking(&mut self, msg: &[u8], timeout: Duration) -> Result<(), String> {
+		let mut sample = self.reserve_blocking(msg.len(), timeout)?;
+		sample.copy_from_slice(msg);
+		sample.submit();
+		Ok(())
+	}
+
+	/// Reserves `size` bytes for a message, so that it's written in place.
+	/// Fails if there is no room for it.
+	pub fn reserve(&mut self, size: usize) -> Result<UrbSample<'_>, String> {
+		let buf_ptr = unsafe { user_ring_buffer__reserve(self.urb_ptr, size as u32) };
+		UrbSample::new(self.urb_ptr, buf_ptr, size)
+	}
+
+	/// Same as `reserve()`, but waits up to `timeout` for room.
+	pub fn reserve_blocking(&mut self, size: usize, timeout: Duration) -> Result<UrbSample<'_>, String> {
+		let timeout_ms = timeout.as_millis().min(c_int::MAX as u128) as c_int;
+		let buf_ptr = unsafe { user_ring_buffer__reserve_blocking(self.urb_ptr, size as u32, timeout_ms) };
+		UrbSample::new(self.urb_ptr, buf_ptr, size)
+	}
+
+	/// Starts a batch of messages, which are submitted together.
+	pub fn batch(&mut self) -> UrbBatch<'_> {
+		UrbBatch {
+			urb_ptr: self.urb_ptr,
+			samples: Vec::new(),
+			_urb: PhantomData,
+		}
+	}
+}
+
+/// A message reserved in a `UserRingBuffer`, written in place through `DerefMut`.
+/// The BPF side sees it after `submit()`. It's discarded if dropped before that.
+pub struct UrbSample<'a> {
+	urb_ptr: *mut user_ring_buffer,
+	buf_ptr: *mut c_void,
+	size: usize,
+	_urb: PhantomData<&'a mut UserRingBuffer>,
+}
+
+impl<'a> UrbSample<'a> {
+	fn new(urb_ptr: *mut user_ring_buffer, buf_ptr: *mut c_void, size: usize) -> Result<Self, String> {
+		if buf_ptr.is_null() {
+			return Err(format!("Failed to reserve urb buffer: errno {}", get_errno_string()));
+		}
+		Ok(UrbSample { urb_ptr, buf_ptr, size, _urb: PhantomData })
+	}
+
+	pub fn submit(self) {
+		unsafe { user_ring_buffer__submit(self.urb_ptr, self.buf_ptr); }
+		std::mem::forget(self);
+	}
+}
+
+impl Deref for UrbSample<'_> {
+	type Target = [u8];
+
+	fn deref(&self) -> &[u8] {
+		unsafe { slice::from_raw_parts(self.buf_ptr as *const u8, self.size) }
+	}
+}
+
+impl DerefMut for UrbSample<'_> {
+	fn deref_mut(&mut self) -> &mut [u8] {
+		unsafe { slice::from_raw_parts_mut(self.buf_ptr as *mut u8, self.size) }
+	}
+}
+
+impl Drop for UrbSample<'_> {
+	fn drop(&mut self) {
+		unsafe { user_ring_buffer__discard(self.urb_ptr, self.buf_ptr); }
+	}
+}
+
+/// Messages reserved one by one and submitted together by `submit()`.
+/// The BPF side stops draining at the first message not submitted yet, so the batch
+/// becomes visible when it's submitted, not while its messages are being written.
+/// The messages are discarded if the batch is dropped before `submit()`.
+pub struct UrbBatch<'a> {
+	urb_ptr: *mut user_ring_buffer,
+	samples: Vec<*mut c_void>,
+	_urb: PhantomData<&'a mut UserRingBuffer>,
+}
+
+impl<'a> UrbBatch<'a> {
+	/// Reserves `size` bytes for a message and lets `f` write it in place.
+	/// Fails if there is no room for it; the messages pushed before are kept.
+	pub fn push_with<F: FnOnce(&mut [u8])>(&mut self, size: usize, f: F) -> Result<(), String> {
+		let buf_ptr = unsafe { user_ring_buffer__reserve(self.urb_ptr, size as u32) };
+		if buf_ptr.is_null() {
+			return Err(format!("Failed to reserve urb buffer: errno {}", get_errno_string()));
+		}
+		f(unsafe { slice::from_raw_parts_mut(buf_ptr as *mut u8, size) });
+		self.samples.push(buf_ptr);
+		Ok(())
+	}
+
+	pub fn push(&mut self, msg: &[u8]) -> Result<(), String> {
+		self.push_with(msg.len(), |buf| buf.copy_from_slice(msg))
+	}
+
+	pub fn len(&self) -> usize {
+		self.samples.len()
+	}
+
+	pub fn is_empty(&self) -> bool {
+		self.samples.is_empty()
+	}
+
+	/// Submits the messages in the order they were pushed. Returns the number of them.
+	pub fn submit(mut self) -> usize {
+		let nr = self.samples.len();
+		for buf_ptr in self.samples.drain(..) {
+			unsafe { user_ring_buffer__submit(self.urb_ptr, buf_ptr); }
+		}
+		nr
+	}
 }
 
 impl Drop for UserRingBuffer {
@@ -80,3 +209,11 @@ impl Drop for UserRingBuffer {
 		}
 	}
 }
+
+impl Drop for UrbBatch<'_> {
+	fn drop(&mut self) {
+		for buf_ptr in self.samples.drain(..) {
+			unsafe { user_ring_buffer__discard(self.urb_ptr, buf_ptr); }
+		}
+	}
+}
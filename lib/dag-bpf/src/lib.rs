@@ -1,29 +1,64 @@
 use bpf_comm::urb::UserRingBuffer;
-use bpf_comm_api::dag_bpf::DagBpfMsg;
+use bpf_comm_api::dag_bpf::{DagBpfMsg, BULK_GRAPH_MAX_SIZE};
 use dag_task::dag::DagTask;
 
-// TODO: Allow specifying the weight
+pub mod sender;
+
+// Sends the whole DAG-task in a single message, which the BPF program installs with one kfunc call.
+// Falls back to a message per node and per edge if it doesn't fit in a single message.
+// The messages are encoded in place and submitted as a batch. They aren't acknowledged;
+// use sender::DagBpfSender to get their results.
 pub fn send_dag_task_to_bpf(urb: &mut UserRingBuffer, dag_task: &DagTask)
+{
+	let mut batch = urb.batch();
+	for msg in dag_task_msgs(dag_task) {
+		batch.push_with(msg.encoded_len(), |buf| { msg.encode_into(0, buf); }).unwrap();
+	}
+	batch.submit();
+}
+
+// Returns the messages which install `dag_task` in the BPF program, in the order to send them.
+fn dag_task_msgs(dag_task: &DagTask) -> Vec<DagBpfMsg>
+{
+	let nodes: Vec<_> = (0..dag_task.nr_nodes)
+		.map(|i| (dag_task.node_to_reactor[i], dag_task.node_to_weight[i] as u32))
+		.collect();
+	let edges: Vec<_> = (0..dag_task.nr_nodes)
+		.flat_map(|i| dag_task.edges[i].iter().map(move |&j| (i as u32, j as u32)))
+		.collect();
+
+	let msg = DagBpfMsg::bulk_graph(dag_task.relative_deadline, dag_task.period, &nodes, &edges);
+	if let DagBpfMsg::BulkGraph(payload) = &msg {
+		if payload.size() > BULK_GRAPH_MAX_SIZE {
+			return dag_task_msgs_incrementally(dag_task);
+		}
+	}
+	vec![msg]
+}
+
+fn dag_task_msgs_incrementally(dag_task: &DagTask) -> Vec<DagBpfMsg>
 {
 	let dag_task_id = dag_task.node_to_reactor[0];
 	let weight = dag_task.node_to_weight[0] as u32;
+	let mut msgs = Vec::new();
 
-	let msg = DagBpfMsg::new_task(dag_task_id, weight, dag_task.relative_deadline, dag_task.period).as_bytes();
-	urb.send_bytes(&msg).unwrap();
+	msgs.push(DagBpfMsg::new_task(dag_task_id, weight, dag_task.relative_deadline, dag_task.period));
 
 	for i in 1..dag_task.nr_nodes {
 		let tid = dag_task.node_to_reactor[i];
 		let weight = dag_task.node_to_weight[i] as u32;
-		let msg = DagBpfMsg::add_node(dag_task_id, tid, weight).as_bytes();
-		urb.send_bytes(&msg).unwrap();
+		msgs.push(DagBpfMsg::add_node(dag_task_id, tid, weight));
 	}
 
 	for i in 0..dag_task.nr_nodes {
 		for j in &dag_task.edges[i] {
 			let from_tid = dag_task.node_to_reactor[i];
 			let to_tid = dag_task.node_to_reactor[*j];
-			let msg = DagBpfMsg::add_edge(dag_task_id, from_tid, to_tid).as_bytes();
-			urb.send_bytes(&msg).unwrap();
+			msgs.push(DagBpfMsg::add_edge(dag_task_id, from_tid, to_tid));
 		}
 	}
+
+	// No more changes to the shape of the DAG-task after this.
+	msgs.push(DagBpfMsg::commit(dag_task_id));
+	msgs
 }
@@ -0,0 +1,259 @@
+use std::cell::{Cell, RefCell};
+use std::collections::VecDeque;
+use std::future::Future;
+use std::pin::Pin;
+use std::rc::Rc;
+use std::task::{Context, Poll, Waker};
+use std::time::{Duration, Instant};
+
+use bpf_comm::ring_buffer::RingBuffer;
+use bpf_comm::urb::UserRingBuffer;
+use bpf_comm_api::dag_bpf::{DagBpfMsg, MsgAck};
+use dag_task::dag::DagTask;
+
+use crate::dag_task_msgs;
+
+/// The default number of messages that may wait for their acks at once.
+pub const DEFAULT_MAX_INFLIGHT: usize = 256;
+
+const ACK_POLL_INTERVAL: Duration = Duration::from_millis(10);
+
+/// Why a message wasn't applied by the BPF program.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum AckError {
+	/// The handler of the message failed with this error.
+	Failed(i64),
+	/// The ack of the message was dropped because `dag_acks` was full.
+	Lost,
+}
+
+/// The id of the created DAG task, node or edge (0 for a commit), or why the message failed.
+pub type AckResult = Result<i64, AckError>;
+
+#[derive(Default)]
+struct AckSlot {
+	result: Option<AckResult>,
+	waker: Option<Waker>,
+}
+
+/// Resolves to the result of a message sent with `DagBpfSender::send_async()`.
+/// It's completed by `DagBpfSender::poll_acks()`, so the acks must be polled
+/// (e.g. from the event loop) for it to make progress.
+pub struct AckFuture {
+	slot: Rc<RefCell<AckSlot>>,
+}
+
+impl AckFuture {
+	fn new() -> (Self, impl FnOnce(AckResult))
+	{
+		let slot = Rc::new(RefCell::new(AckSlot::default()));
+		let done = {
+			let slot = slot.clone();
+			move |result| {
+				let mut slot = slot.borrow_mut();
+				slot.result = Some(result);
+				if let Some(waker) = slot.waker.take() {
+					waker.wake();
+				}
+			}
+		};
+		(AckFuture { slot }, done)
+	}
+}
+
+impl Future for AckFuture {
+	type Output = AckResult;
+
+	fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<AckResult>
+	{
+		let mut slot = self.slot.borrow_mut();
+		match slot.result.take() {
+			Some(result) => Poll::Ready(result),
+			None => {
+				slot.waker = Some(cx.waker().clone());
+				Poll::Pending
+			}
+		}
+	}
+}
+
+struct Pending {
+	seq: u64,
+	done: Box<dyn FnOnce(AckResult)>,
+}
+
+/// Sends messages to the BPF program without waiting for each of them to be handled.
+/// Every message gets a sequence number, and the BPF program acknowledges it with the
+/// result of its handler through the `BPF_MAP_TYPE_RINGBUF` map of acks. Up to
+/// `max_inflight` messages may be unacknowledged; sending more waits for acks first.
+pub struct DagBpfSender {
+	urb: UserRingBuffer,
+	acks: RingBuffer,
+	next_seq: u64,
+	pending: VecDeque<Pending>,
+	max_inflight: usize,
+	timeout: Duration,
+}
+
+impl DagBpfSender {
+	/// Creates a `DagBpfSender` sending to the map `urb_name` and receiving acks from the map `acks_name`.
+	pub fn new(urb_name: &str, acks_name: &str) -> Result<DagBpfSender, String>
+	{
+		Ok(DagBpfSender {
+			urb: UserRingBuffer::new(urb_name)?,
+			acks: RingBuffer::new(acks_name)?,
+			next_seq: 1, // 0 is for the messages sent without a sequence number
+			pending: VecDeque::new(),
+			max_inflight: DEFAULT_MAX_INFLIGHT,
+			timeout: Duration::from_secs(1),
+		})
+	}
+
+	pub fn with_max_inflight(mut self, max_inflight: usize) -> Self
+	{
+		self.max_inflight = max_inflight.max(1);
+		self
+	}
+
+	/// Sets how long `send_with()` and `flush()` wait for acks, or for room in the urb, before giving up.
+	pub fn with_timeout(mut self, timeout: Duration) -> Self
+	{
+		self.timeout = timeout;
+		self
+	}
+
+	/// Returns the number of the messages waiting for their acks.
+	pub fn inflight(&self) -> usize
+	{
+		self.pending.len()
+	}
+
+	/// Sends `msg` and calls `done` with its result from `poll_acks()`.
+	/// Returns the sequence number of the message.
+	pub fn send_with<F: FnOnce(AckResult) + 'static>(&mut self, msg: &DagBpfMsg, done: F) -> Result<u64, String>
+	{
+		self.wait_for_acks(self.max_inflight - 1)?;
+
+		let seq = self.next_seq;
+		let mut sample = self.urb.reserve_blocking(msg.encoded_len(), self.timeout)?;
+		msg.encode_into(seq, &mut sample);
+		sample.submit();
+		self.next_seq += 1;
+		self.pending.push_back(Pending { seq, done: Box::new(done) });
+		Ok(seq)
+	}
+
+	/// Sends `msg` and returns a future of its result.
+	pub fn send_async(&mut self, msg: &DagBpfMsg) -> Result<AckFuture, String>
+	{
+		let (future, done) = AckFuture::new();
+		self.send_with(msg, done)?;
+		Ok(future)
+	}
+
+	/// Sends `dag_task` without waiting for the BPF program to install it. The returned
+	/// future resolves to the id of the DAG task, or to the first error among its messages.
+	pub fn send_dag_task(&mut self, dag_task: &DagTask) -> Result<AckFuture, String>
+	{
+		let msgs = dag_task_msgs(dag_task);
+		let (last, rest) = msgs.split_last().unwrap();
+		// The id of the DAG task from the first message, and the first error
+		let state = Rc::new(Cell::new((None::<i64>, None::<AckError>)));
+
+		for (i, msg) in rest.iter().enumerate() {
+			let state = state.clone();
+			self.send_with(msg, move |result| {
+				let (id, err) = state.get();
+				match result {
+					Ok(ret) if i == 0 => state.set((Some(ret), err)),
+					Ok(_) => {}
+					Err(e) => state.set((id, err.or(Some(e)))),
+				}
+			})?;
+		}
+
+		let (future, done) = AckFuture::new();
+		self.send_with(last, move |result| {
+			let (id, err) = state.get();
+			done(match (err, result) {
+				(Some(e), _) | (None, Err(e)) => Err(e),
+				(None, Ok(ret)) => Ok(id.unwrap_or(ret)),
+			});
+		})?;
+		Ok(future)
+	}
+
+	/// Waits up to `timeout` for acks and completes the messages they belong to.
+	/// Returns the number of the acks received.
+	pub fn poll_acks(&mut self, timeout: Duration) -> Result<usize, String>
+	{
+		let pending = &mut self.pending;
+		self.acks.poll(timeout, |data| {
+			if let Some(ack) = MsgAck::from_bytes(data) {
+				complete(pending, ack.seq, ack.ret);
+			}
+		})
+	}
+
+	/// Waits until all the messages sent so far are acknowledged.
+	pub fn flush(&mut self) -> Result<(), String>
+	{
+		self.wait_for_acks(0)
+	}
+
+	fn wait_for_acks(&mut self, max_pending: usize) -> Result<(), String>
+	{
+		let deadline = Instant::now() + self.timeout;
+		while self.pending.len() > max_pending {
+			let now = Instant::now();
+			if now >= deadline {
+				return Err(format!("{} messages are not acknowledged in {:?}", self.pending.len(), self.timeout));
+			}
+			self.poll_acks((deadline - now).min(ACK_POLL_INTERVAL))?;
+		}
+		Ok(())
+	}
+}
+
+// Completes the message `seq` with `ret`. The acks come in the order of the messages,
+// so the messages before it whose acks haven't come have lost theirs.
+fn complete(pending: &mut VecDeque<Pending>, seq: u64, ret: i64)
+{
+	while let Some(front) = pending.front() {
+		if front.seq > seq {
+			break; // not ours, e.g. a message sent without a sequence number
+		}
+		let p = pending.pop_front().unwrap();
+		if p.seq == seq {
+			(p.done)(if ret >= 0 { Ok(ret) } else { Err(AckError::Failed(ret)) });
+			break;
+		}
+		(p.done)(Err(AckError::Lost));
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+
+	#[test]
+	fn complete_in_order() {
+		let results = Rc::new(RefCell::new(Vec::new()));
+		let mut pending = VecDeque::new();
+		for seq in 1..=4 {
+			let results = results.clone();
+			pending.push_back(Pending { seq, done: Box::new(move |r| results.borrow_mut().push((seq, r))) });
+		}
+
+		complete(&mut pending, 0, 0); // an ack of a message without a sequence number
+		complete(&mut pending, 1, 1000);
+		complete(&mut pending, 3, -22); // the ack of 2 was dropped
+
+		assert_eq!(*results.borrow(), vec![
+			(1, Ok(1000)),
+			(2, Err(AckError::Lost)),
+			(3, Err(AckError::Failed(-22))),
+		]);
+		assert_eq!(pending.len(), 1);
+	}
+}
@@ -0,0 +1,96 @@
+//! Throughput benchmark of the schedulability analysis.
+//!
+//!   $ cargo bench --bench analysis
+//!
+//! Generates task sets of random layered DAGs and reports how many DAG tasks
+//! per second each analysis processes, with one thread and with all CPUs.
+
+use std::time::Instant;
+
+use dag_task::analysis::{Analyzer, Policy};
+use dag_task::dag::DagTask;
+
+const NR_CORES: usize = 64;
+const NR_NODES: usize = 64;
+
+/// A minimal xorshift generator, so the task sets are reproducible.
+struct Rng(u64);
+
+impl Rng {
+	fn next(&mut self) -> u64
+	{
+		self.0 ^= self.0 << 13;
+		self.0 ^= self.0 >> 7;
+		self.0 ^= self.0 << 17;
+		self.0
+	}
+
+	fn range(&mut self, lo: u64, hi: u64) -> u64
+	{
+		lo + self.next() % (hi - lo)
+	}
+}
+
+/// A DAG of NR_NODES nodes in layers of up to 8 nodes. Each node has an
+/// edge from up to 3 random nodes of the previous layer.
+fn random_dag_task(id: usize, rng: &mut Rng) -> DagTask
+{
+	let mut dag_task = DagTask::new(id);
+	dag_task.nr_nodes = NR_NODES;
+	dag_task.node_to_reactor = (0..NR_NODES as i32).collect();
+	dag_task.node_to_weight = (0..NR_NODES).map(|_| rng.range(10, 1000) as i64).collect();
+	dag_task.edges = vec![vec![]; NR_NODES];
+
+	let (mut prev, mut curr) = (0..1, 1..1);
+	while curr.end < NR_NODES {
+		curr = curr.end..(curr.end + rng.range(1, 9) as usize).min(NR_NODES);
+		for v in curr.clone() {
+			for _ in 0..rng.range(1, 4) {
+				let u = rng.range(prev.start as u64, prev.end as u64) as usize;
+				if !dag_task.edges[u].contains(&v) {
+					dag_task.edges[u].push(v);
+				}
+			}
+		}
+		prev = curr.clone();
+	}
+
+	let volume: i64 = dag_task.node_to_weight.iter().sum();
+	dag_task.period = volume * rng.range(20, 200) as i64;
+	dag_task.relative_deadline = dag_task.period;
+	dag_task
+}
+
+fn bench<R>(name: &str, nr_dag_tasks: usize, f: impl Fn() -> R)
+{
+	const NR_ITERS: u32 = 5;
+
+	f(); // warm up
+	let start = Instant::now();
+	for _ in 0..NR_ITERS {
+		std::hint::black_box(f());
+	}
+	let secs = start.elapsed().as_secs_f64() / NR_ITERS as f64;
+	println!("{name:<40} {:>10.3} ms {:>12.0} DAGs/s", secs * 1e3, nr_dag_tasks as f64 / secs);
+}
+
+fn main()
+{
+	let mut rng = Rng(0x2545_f491_4f6c_dd1d);
+
+	for nr_dag_tasks in [1000, 4000] {
+		let dag_tasks: Vec<DagTask> = (0..nr_dag_tasks).map(|i| random_dag_task(i, &mut rng)).collect();
+
+		for analyzer in [Analyzer::new(NR_CORES).with_threads(1), Analyzer::new(NR_CORES)] {
+			let tag = format!("{nr_dag_tasks} DAGs, {} threads", analyzer.nr_threads);
+			let metrics = analyzer.metrics(&dag_tasks).unwrap();
+
+			bench(&format!("metrics ({tag})"), nr_dag_tasks, || analyzer.metrics(&dag_tasks));
+			bench(&format!("global EDF RTA ({tag})"), nr_dag_tasks,
+			      || analyzer.response_times_of(&metrics, Policy::Helt));
+			bench(&format!("HLBS RTA ({tag})"), nr_dag_tasks,
+			      || analyzer.response_times_of(&metrics, Policy::Hlbs));
+			bench(&format!("federated ({tag})"), nr_dag_tasks, || analyzer.federated_of(&metrics));
+		}
+	}
+}
@@ -0,0 +1,465 @@
+//! Offline schedulability analysis of DAG task sets on an m-core platform.
+//!
+//! All the times are in the unit of the node weights (ns for the task sets
+//! sent to dag_bpf.ko). The per-DAG work is spread across threads, so task
+//! sets with thousands of DAGs can be analyzed for admission decisions and
+//! configuration sweeps.
+
+use std::num::NonZeroUsize;
+use std::thread;
+
+use crate::dag::DagTask;
+
+/// The volume and the critical path of a DAG task.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct DagMetrics {
+	pub volume: i64,        // C: the sum of the weights
+	pub critical_path: i64, // L: the length of the longest path
+	pub deadline: i64,      // D
+	pub period: i64,        // T, i64::MAX if the DAG task isn't periodic
+}
+
+impl DagMetrics {
+	/// Fails if the DAG task has no positive relative deadline, e.g. -1 for
+	/// no deadline, which none of the analyses can handle.
+	pub fn of(dag_task: &DagTask) -> Result<Self, String>
+	{
+		if dag_task.relative_deadline <= 0 {
+			return Err(format!("DAG task {} has a non-positive deadline ({})",
+					   dag_task.id, dag_task.relative_deadline));
+		}
+
+		let (volume, critical_path) = volume_and_critical_path(dag_task);
+		Ok(Self {
+			volume,
+			critical_path,
+			deadline: dag_task.relative_deadline,
+			period: if dag_task.period > 0 { dag_task.period } else { i64::MAX },
+		})
+	}
+
+	/// A DAG task is heavy if it can't meet its deadline on a single core.
+	pub fn is_heavy(&self) -> bool
+	{
+		self.volume > self.deadline
+	}
+
+	/// The density C / min(D, T). D and T are positive by `DagMetrics::of`.
+	pub fn density(&self) -> f64
+	{
+		self.volume as f64 / self.deadline.min(self.period) as f64
+	}
+
+	/// Graham's bound on the makespan of the DAG task alone on `m` cores
+	/// under any work-conserving scheduler: L + (C - L) / m.
+	pub fn graham_bound(&self, m: usize) -> i64
+	{
+		self.critical_path + (self.volume - self.critical_path) / m as i64
+	}
+}
+
+/// The result of federated scheduling.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct FederatedAllocation {
+	/// The dedicated cores of each DAG task, 0 if it is light.
+	pub cores: Vec<usize>,
+	/// The shared core each light DAG task is partitioned to, `None` if heavy.
+	/// The shared cores are numbered after the dedicated ones.
+	pub shared_core: Vec<Option<usize>>,
+	/// The number of cores used in total.
+	pub nr_used_cores: usize,
+}
+
+/// The priorities of dag_bpf.ko whose response times are bounded.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Policy {
+	/// The keys order the nodes of different jobs by their deadlines, i.e.
+	/// job-level global EDF.
+	Helt,
+	/// The keys order the nodes by their latest start times, which aren't
+	/// tied to the job deadlines.
+	Hlbs,
+}
+
+pub struct Analyzer {
+	pub nr_cores: usize,
+	pub nr_threads: usize,
+}
+
+/// The maximum number of refinement rounds of `Analyzer::response_times`.
+const MAX_RTA_ROUNDS: usize = 16;
+
+impl Analyzer {
+	/// Analyzes task sets on `nr_cores` cores with all the available CPUs.
+	pub fn new(nr_cores: usize) -> Self
+	{
+		assert!(nr_cores > 0);
+		Self {
+			nr_cores,
+			nr_threads: thread::available_parallelism().map_or(1, NonZeroUsize::get),
+		}
+	}
+
+	pub fn with_threads(mut self, nr_threads: usize) -> Self
+	{
+		self.nr_threads = nr_threads.max(1);
+		self
+	}
+
+	/// Fails on the first DAG task rejected by `DagMetrics::of`.
+	pub fn metrics(&self, dag_tasks: &[DagTask]) -> Result<Vec<DagMetrics>, String>
+	{
+		par_map(dag_tasks, self.nr_threads, |_, dag_task| DagMetrics::of(dag_task))
+			.into_iter()
+			.collect()
+	}
+
+	/// Response-time bounds of the DAG tasks under `policy`, following the
+	/// analysis of Melani et al. (ECRTS 2015):
+	///
+	///   R_k = L_k + (C_k - L_k + sum_{i != k} I_i) / m
+	///
+	/// The interference I_i of DAG task i is at most its carry-in workload in
+	/// a window of R_k, which holds for any work-conserving global policy, so
+	/// that's the bound for `Policy::Hlbs`. With `Policy::Helt`, a job only
+	/// suffers from the jobs with earlier deadlines, so I_i is also capped by
+	/// the workload of the jobs of DAG task i whose deadlines fall within
+	/// D_k. The bounds start from R_i = D_i and are refined with the bounds
+	/// of the previous round, which is sound because they only decrease.
+	///
+	/// Returns `None` for a DAG task whose bound exceeds its deadline.
+	pub fn response_times(&self, dag_tasks: &[DagTask], policy: Policy)
+			      -> Result<Vec<Option<i64>>, String>
+	{
+		let metrics = self.metrics(dag_tasks)?;
+		Ok(self.response_times_of(&metrics, policy))
+	}
+
+	pub fn response_times_of(&self, metrics: &[DagMetrics], policy: Policy) -> Vec<Option<i64>>
+	{
+		let m = self.nr_cores as i64;
+		let mut bounds: Vec<i64> = metrics.iter().map(|x| x.deadline).collect();
+		let mut result = vec![None; metrics.len()];
+
+		for _ in 0..MAX_RTA_ROUNDS {
+			result = par_map(metrics, self.nr_threads, |k, _| {
+				response_time(metrics, &bounds, k, m, policy)
+			});
+
+			let mut changed = false;
+			for (bound, r) in bounds.iter_mut().zip(&result) {
+				if let Some(r) = r {
+					changed |= *r < *bound;
+					*bound = *r;
+				}
+			}
+			if !changed || result.iter().any(Option::is_none) {
+				break;
+			}
+		}
+
+		result
+	}
+
+	/// Federated scheduling (Li et al., ECRTS 2014). A heavy DAG task gets
+	/// ceil((C - L) / (D - L)) dedicated cores, and the light DAG tasks are
+	/// partitioned onto the remaining cores by first-fit decreasing density.
+	///
+	/// Returns `None` if a heavy DAG task has D <= L or the cores run out.
+	pub fn federated(&self, dag_tasks: &[DagTask]) -> Result<Option<FederatedAllocation>, String>
+	{
+		let metrics = self.metrics(dag_tasks)?;
+		Ok(self.federated_of(&metrics))
+	}
+
+	pub fn federated_of(&self, metrics: &[DagMetrics]) -> Option<FederatedAllocation>
+	{
+		let mut cores = vec![0; metrics.len()];
+		let mut nr_dedicated = 0;
+		for (i, x) in metrics.iter().enumerate() {
+			if !x.is_heavy() {
+				continue;
+			}
+			if x.deadline <= x.critical_path {
+				return None;
+			}
+			let slack = x.deadline - x.critical_path;
+			cores[i] = ((x.volume - x.critical_path + slack - 1) / slack) as usize;
+			nr_dedicated += cores[i];
+		}
+		if nr_dedicated > self.nr_cores {
+			return None;
+		}
+
+		let mut light: Vec<usize> = (0..metrics.len()).filter(|i| !metrics[*i].is_heavy()).collect();
+		light.sort_by(|a, b| metrics[*b].density().total_cmp(&metrics[*a].density()));
+
+		let mut shared_core = vec![None; metrics.len()];
+		let mut load: Vec<f64> = vec![];
+		for i in light {
+			let density = metrics[i].density();
+			let core = match load.iter().position(|x| x + density <= 1.0) {
+				Some(core) => core,
+				None => {
+					load.push(0.0);
+					load.len() - 1
+				},
+			};
+			load[core] += density;
+			shared_core[i] = Some(nr_dedicated + core);
+		}
+
+		let nr_used_cores = nr_dedicated + load.len();
+		if nr_used_cores > self.nr_cores {
+			return None;
+		}
+
+		Some(FederatedAllocation { cores, shared_core, nr_used_cores })
+	}
+}
+
+/// Returns (C, L) of `dag_task`. The nodes are visited in topological order
+/// (Kahn's algorithm), so it doesn't rely on the order of the node ids.
+fn volume_and_critical_path(dag_task: &DagTask) -> (i64, i64)
+{
+	let nr_nodes = dag_task.nr_nodes;
+	let weight = &dag_task.node_to_weight;
+	let mut nr_ins = vec![0u32; nr_nodes];
+	for outs in &dag_task.edges {
+		for v in outs {
+			nr_ins[*v] += 1;
+		}
+	}
+
+	let mut finish = vec![0i64; nr_nodes];
+	let mut queue: Vec<usize> = (0..nr_nodes).filter(|u| nr_ins[*u] == 0).collect();
+	let mut critical_path = 0;
+	while let Some(u) = queue.pop() {
+		finish[u] += weight[u];
+		critical_path = critical_path.max(finish[u]);
+		for v in &dag_task.edges[u] {
+			finish[*v] = finish[*v].max(finish[u]);
+			nr_ins[*v] -= 1;
+			if nr_ins[*v] == 0 {
+				queue.push(*v);
+			}
+		}
+	}
+
+	(weight.iter().sum(), critical_path)
+}
+
+/// The workload of DAG task `x` with response-time bound `r` in a window of
+/// length `len`, with a carry-in job whose work is spread over m cores.
+fn carry_in_workload(x: &DagMetrics, r: i64, len: i64, m: i64) -> i128
+{
+	let a = len as i128 + r as i128 - (x.volume / m) as i128;
+	if a <= 0 {
+		return 0;
+	}
+	let (c, t) = (x.volume as i128, x.period as i128);
+	(a / t) * c + c.min(m as i128 * (a % t))
+}
+
+/// The workload of the jobs of DAG task `x` whose deadlines fall within a
+/// window of length `len` that ends at a deadline.
+fn deadline_workload(x: &DagMetrics, r: i64, len: i64, m: i64) -> i128
+{
+	let (c, t) = (x.volume as i128, x.period as i128);
+	let len = len as i128;
+	let tail = (len % t - x.deadline as i128 + r as i128).max(0);
+	(len / t) * c + c.min(m as i128 * tail)
+}
+
+fn response_time(metrics: &[DagMetrics], bounds: &[i64], k: usize, m: i64, policy: Policy) -> Option<i64>
+{
+	let x = &metrics[k];
+	let self_work = (x.volume - x.critical_path) as i128;
+	let mut r = x.graham_bound(m as usize);
+
+	loop {
+		if r > x.deadline {
+			return None;
+		}
+
+		let mut interference = 0i128;
+		for (i, y) in metrics.iter().enumerate() {
+			if i == k {
+				continue;
+			}
+			let work = carry_in_workload(y, bounds[i], r, m);
+			interference += match policy {
+				Policy::Helt => work.min(deadline_workload(y, bounds[i], x.deadline, m)),
+				Policy::Hlbs => work,
+			};
+		}
+
+		let next = x.critical_path as i128 + (self_work + interference) / m as i128;
+		if next > x.deadline as i128 {
+			return None;
+		}
+		if next as i64 == r {
+			return Some(r);
+		}
+		r = next as i64;
+	}
+}
+
+/// Maps `f` over `items` on up to `nr_threads` scoped threads, keeping the order.
+fn par_map<T, R, F>(items: &[T], nr_threads: usize, f: F) -> Vec<R>
+where
+	T: Sync,
+	R: Send,
+	F: Fn(usize, &T) -> R + Sync,
+{
+	let nr_threads = nr_threads.min(items.len()).max(1);
+	if nr_threads == 1 {
+		return items.iter().enumerate().map(|(i, x)| f(i, x)).collect();
+	}
+
+	let chunk_size = items.len().div_ceil(nr_threads);
+	let f = &f;
+	thread::scope(|s| {
+		let handles: Vec<_> = items.chunks(chunk_size).enumerate().map(|(c, chunk)| {
+			s.spawn(move || {
+				chunk.iter().enumerate()
+					.map(|(i, x)| f(c * chunk_size + i, x))
+					.collect::<Vec<R>>()
+			})
+		}).collect();
+
+		handles.into_iter().flat_map(|h| h.join().unwrap()).collect()
+	})
+}
+
+#[cfg(test)]
+fn new_dag_task(weights: &[i64], edges: &[(usize, usize)], deadline: i64, period: i64) -> DagTask
+{
+	let mut dag_task = DagTask::new(0);
+	dag_task.nr_nodes = weights.len();
+	dag_task.node_to_reactor = (0..weights.len() as i32).collect();
+	dag_task.node_to_weight = weights.to_vec();
+	dag_task.edges = vec![vec![]; weights.len()];
+	for (from, to) in edges {
+		dag_task.edges[*from].push(*to);
+	}
+	dag_task.relative_deadline = deadline;
+	dag_task.period = period;
+	dag_task
+}
+
+///        +---> 1(4) ---+
+///        |             V
+/// 0(4) --+            3(4)
+///        |             A
+///        +---> 2(4) ---+
+#[cfg(test)]
+fn diamond(deadline: i64, period: i64) -> DagTask
+{
+	new_dag_task(&[4, 4, 4, 4], &[(0, 1), (0, 2), (1, 3), (2, 3)], deadline, period)
+}
+
+#[test]
+fn test_metrics()
+{
+	let metrics = DagMetrics::of(&diamond(14, 20)).unwrap();
+	assert_eq!(metrics.volume, 16);
+	assert_eq!(metrics.critical_path, 12);
+	assert!(metrics.is_heavy());
+	assert_eq!(metrics.graham_bound(2), 14);
+
+	// The node ids don't have to be in topological order.
+	let dag_task = new_dag_task(&[1, 5, 2], &[(2, 0), (0, 1)], 100, 100);
+	assert_eq!(DagMetrics::of(&dag_task).unwrap().critical_path, 8);
+
+	// No deadline
+	assert!(DagMetrics::of(&diamond(-1, 20)).is_err());
+	assert!(DagMetrics::of(&diamond(0, 20)).is_err());
+	assert!(Analyzer::new(2).federated(&[diamond(14, 20), diamond(0, 20)]).is_err());
+}
+
+#[test]
+fn test_response_times()
+{
+	// Alone, the bound is Graham's.
+	let analyzer = Analyzer::new(2);
+	for policy in [Policy::Helt, Policy::Hlbs] {
+		let r = analyzer.response_times(&[diamond(20, 20)], policy).unwrap();
+		assert_eq!(r, vec![Some(14)]);
+	}
+
+	// Interference from another DAG task delays it.
+	let dag_tasks = [diamond(20, 20), new_dag_task(&[4], &[], 20, 20)];
+	let r = analyzer.response_times(&dag_tasks, Policy::Helt).unwrap();
+	assert!(r[0].unwrap() > 14 && r[0].unwrap() <= 20);
+	assert!(r[1].is_some());
+
+	// One core can't finish 16 units of work by 14.
+	let r = Analyzer::new(1).response_times(&[diamond(14, 20)], Policy::Helt).unwrap();
+	assert_eq!(r, vec![None]);
+}
+
+#[test]
+fn test_response_times_hlbs()
+{
+	// Under EDF, the jobs of the DAG task with the later deadline don't
+	// interfere, but HLBS doesn't order the jobs by their deadlines.
+	let analyzer = Analyzer::new(2);
+	let dag_tasks = [diamond(20, 20), new_dag_task(&[4], &[], 100, 100)];
+	let edf = analyzer.response_times(&dag_tasks, Policy::Helt).unwrap();
+	let hlbs = analyzer.response_times(&dag_tasks, Policy::Hlbs).unwrap();
+	assert_eq!(edf[0], Some(14));
+	assert!(hlbs[0].unwrap() > 14);
+
+	// Dropping the deadline cap never tightens a bound.
+	let dag_tasks: Vec<DagTask> = (0..32)
+		.map(|i| new_dag_task(&[1 + i % 5, 2, 3], &[(0, 1), (0, 2)], 40 + i * 3, 80 + i * 5))
+		.collect();
+	let analyzer = Analyzer::new(4);
+	let edf = analyzer.response_times(&dag_tasks, Policy::Helt).unwrap();
+	let hlbs = analyzer.response_times(&dag_tasks, Policy::Hlbs).unwrap();
+	for (e, h) in edf.iter().zip(&hlbs) {
+		match (e, h) {
+			(Some(e), Some(h)) => assert!(h >= e),
+			(None, Some(_)) => panic!("HLBS bound {h:?} without an EDF bound"),
+			_ => {},
+		}
+	}
+	assert!(hlbs.iter().any(Option::is_some));
+}
+
+#[test]
+fn test_federated()
+{
+	// ceil((16 - 12) / (14 - 12)) = 2 dedicated cores, and the light tasks
+	// share one core.
+	let dag_tasks = [
+		diamond(14, 20),
+		new_dag_task(&[2], &[], 10, 10),
+		new_dag_task(&[3], &[], 10, 10),
+	];
+	let allocation = Analyzer::new(4).federated(&dag_tasks).unwrap().unwrap();
+	assert_eq!(allocation.cores, vec![2, 0, 0]);
+	assert_eq!(allocation.shared_core, vec![None, Some(2), Some(2)]);
+	assert_eq!(allocation.nr_used_cores, 3);
+
+	assert!(Analyzer::new(2).federated(&dag_tasks).unwrap().is_none());
+	assert!(Analyzer::new(4).federated(&[diamond(12, 20)]).unwrap().is_none()); // D <= L
+}
+
+#[test]
+fn test_parallel_matches_sequential()
+{
+	let dag_tasks: Vec<DagTask> = (0..64)
+		.map(|i| new_dag_task(&[1 + i % 5, 2, 3], &[(0, 1), (0, 2)], 200 + i * 7, 400))
+		.collect();
+
+	let sequential = Analyzer::new(8).with_threads(1);
+	let parallel = Analyzer::new(8).with_threads(4);
+	assert_eq!(sequential.metrics(&dag_tasks), parallel.metrics(&dag_tasks));
+	for policy in [Policy::Helt, Policy::Hlbs] {
+		assert_eq!(sequential.response_times(&dag_tasks, policy),
+			   parallel.response_times(&dag_tasks, policy));
+	}
+	assert_eq!(sequential.federated(&dag_tasks), parallel.federated(&dag_tasks));
+}
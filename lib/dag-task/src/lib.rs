@@ -1 +1,2 @@
 pub mod dag;
+pub mod analysis;
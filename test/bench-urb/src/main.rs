@@ -0,0 +1,90 @@
+use std::fs;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use bpf_comm::urb::UserRingBuffer;
+use bpf_comm_api::dag_bpf::DagBpfMsg;
+
+const USER_RING_BUFFER_NAME: &'static str = "urb";
+const URB_DRAIN_PATH: &'static str = "/sys/kernel/my_ops/urb_drain";
+const BATCH_SIZE: usize = 64;
+
+// Compares the messages per second of the ways to send messages with UserRingBuffer.
+// Run it with dag_bpf.ko and the BPF program loaded. The messages are commits of
+// a DAG task which doesn't exist, so the BPF program rejects them right away.
+//
+//   $ sudo target/debug/bench-urb [number of messages]
+fn main() {
+	let nr_msgs: usize = std::env::args().nth(1).and_then(|s| s.parse().ok()).unwrap_or(1_000_000);
+	let mut urb = UserRingBuffer::new(USER_RING_BUFFER_NAME).unwrap();
+	let msg = DagBpfMsg::commit(0);
+	let len = msg.encoded_len();
+
+	// Drain urb all the time, so that the producer is what's measured.
+	let stop = Arc::new(AtomicBool::new(false));
+	let drainer = {
+		let stop = stop.clone();
+		thread::spawn(move || {
+			while !stop.load(Ordering::Relaxed) {
+				let _ = fs::write(URB_DRAIN_PATH, "1");
+				thread::sleep(Duration::from_micros(100));
+			}
+		})
+	};
+
+	bench("send_bytes(as_bytes())", nr_msgs, |_| {
+		while urb.send_bytes(&msg.as_bytes()).is_err() {
+			thread::yield_now();
+		}
+		1
+	});
+
+	bench("reserve + encode_into", nr_msgs, |_| {
+		loop {
+			if let Ok(mut sample) = urb.reserve(len) {
+				msg.encode_into(0, &mut sample);
+				sample.submit();
+				return 1;
+			}
+			thread::yield_now();
+		}
+	});
+
+	bench("send_blocking", nr_msgs, |_| {
+		urb.send_blocking(&msg.as_bytes(), Duration::from_secs(1)).unwrap();
+		1
+	});
+
+	bench(&format!("batch of {}", BATCH_SIZE), nr_msgs, |left| {
+		let mut batch = urb.batch();
+		while batch.len() < BATCH_SIZE.min(left) {
+			if batch.push_with(len, |buf| { msg.encode_into(0, buf); }).is_err() {
+				break;
+			}
+		}
+		let nr = batch.submit();
+		if nr == 0 {
+			thread::yield_now();
+		}
+		nr
+	});
+
+	stop.store(true, Ordering::Relaxed);
+	drainer.join().unwrap();
+}
+
+// Calls `send` until it sends `nr_msgs` messages, and prints the throughput.
+// `send` gets the number of the messages left and returns the number of the messages it sent.
+fn bench<F: FnMut(usize) -> usize>(name: &str, nr_msgs: usize, mut send: F) {
+	let start = Instant::now();
+	let mut sent = 0;
+	while sent < nr_msgs {
+		sent += send(nr_msgs - sent);
+	}
+	let elapsed = start.elapsed();
+
+	println!("{:<24} {:>10} msgs in {:>8.3?}: {:>12.0} msgs/s",
+		name, sent, elapsed, sent as f64 / elapsed.as_secs_f64());
+}